@@ -0,0 +1,56 @@
+#pragma once
+
+// Zombie archetypes. Particles of one type are stored as one contiguous
+// block and integrated by a kernel instantiated from the type's traits, so
+// its tunables are compile-time constants and there is no per-particle
+// branching on the type.
+enum class ZombieType { Walker, Runner, Brute, Crawler, Count };
+
+const int kZombieTypeCount = (int)ZombieType::Count;
+
+// size scales the zombie size set from the UI. separationWeight is the
+// repulsion per unit of overlap; Walker keeps the values the simulation
+// always used.
+struct WalkerTraits {
+  static constexpr float maxSpeed = 10.0f;
+  static constexpr float maxForce = 20.0f; // Steering force magnitude
+  static constexpr float separationWeight = 50.0f;
+  static constexpr float size = 1.0f;
+};
+
+struct RunnerTraits {
+  static constexpr float maxSpeed = 16.0f;
+  static constexpr float maxForce = 32.0f;
+  static constexpr float separationWeight = 50.0f;
+  static constexpr float size = 0.8f;
+};
+
+struct BruteTraits {
+  static constexpr float maxSpeed = 6.0f;
+  static constexpr float maxForce = 14.0f;
+  static constexpr float separationWeight = 80.0f;
+  static constexpr float size = 1.5f;
+};
+
+struct CrawlerTraits {
+  static constexpr float maxSpeed = 3.5f;
+  static constexpr float maxForce = 10.0f;
+  static constexpr float separationWeight = 40.0f;
+  static constexpr float size = 0.7f;
+};
+
+// Runtime lookups for code that handles all types in one pass (rendering,
+// pairwise separation)
+inline float zombieTypeSize(ZombieType type) {
+  static const float sizes[kZombieTypeCount] = {
+      WalkerTraits::size, RunnerTraits::size, BruteTraits::size,
+      CrawlerTraits::size};
+  return sizes[(int)type];
+}
+
+inline float zombieTypeSeparationWeight(ZombieType type) {
+  static const float weights[kZombieTypeCount] = {
+      WalkerTraits::separationWeight, RunnerTraits::separationWeight,
+      BruteTraits::separationWeight, CrawlerTraits::separationWeight};
+  return weights[(int)type];
+}
@@ -0,0 +1,148 @@
+#include "CongestionField.hpp"
+#include "Instrumentation.hpp"
+#include <cmath>
+#include <functional>
+
+CongestionField::CongestionField(const Map *map)
+    : m_map(map), m_width(map->getWidth()), m_height(map->getHeight()),
+      m_blocksX((m_width + kBlock - 1) / kBlock),
+      m_blocksY((m_height + kBlock - 1) / kBlock), m_front(-1), m_builds(0),
+      m_lastBuildTime(0.0f), m_pending(false), m_quit(false), m_busy(false) {
+  m_counts.resize(m_blocksX * m_blocksY, 0);
+  m_cost.resize(m_width * m_height);
+  m_distance.resize(m_width * m_height);
+  m_heap.reserve(m_width * m_height);
+  m_fields[0].resize(m_width * m_height, {0.0f, 0.0f});
+  m_fields[1].resize(m_width * m_height, {0.0f, 0.0f});
+}
+
+CongestionField::~CongestionField() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void CongestionField::start() {
+  m_thread = std::thread(&CongestionField::run, this);
+}
+
+void CongestionField::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_pending || m_quit; });
+      if (m_quit)
+        return;
+      m_pending = false;
+    }
+
+    // The reader only ever looks at the front buffer, and only one build
+    // runs at a time, so the other one is ours.
+    int front = m_front.load(std::memory_order_relaxed);
+    int back = front == 0 ? 1 : 0;
+    double start = Instrumentation::now();
+    build(m_fields[back]);
+    m_lastBuildTime.store(Instrumentation::now() - start,
+                          std::memory_order_relaxed);
+    m_builds.fetch_add(1, std::memory_order_relaxed);
+
+    m_front.store(back, std::memory_order_release);
+    m_busy.store(false, std::memory_order_release);
+  }
+}
+
+void CongestionField::build(std::vector<Map::Vector2> &field) {
+  const std::vector<unsigned char> &data = m_map->getData();
+  int w = m_width;
+  int h = m_height;
+  const float blockArea = kBlock * kBlock;
+
+  for (int y = 0; y < h; ++y) {
+    const int *blockRow = &m_counts[(y / kBlock) * m_blocksX];
+    for (int x = 0; x < w; ++x) {
+      float density = blockRow[x / kBlock] / blockArea;
+      m_cost[y * w + x] = 1.0f + kWeight * density;
+    }
+  }
+
+  // Dijkstra from every open goal cell at once; walls are never entered
+  const float unreached = -1.0f;
+  std::fill(m_distance.begin(), m_distance.end(), unreached);
+  std::vector<std::pair<float, int>> &heap = m_heap;
+  heap.clear();
+  auto later = std::greater<std::pair<float, int>>();
+
+  const std::vector<unsigned char> &goalIds = m_map->getGoalIds();
+  for (int i = 0; i < w * h; ++i) {
+    if (goalIds[i] && data[i] == 0) {
+      m_distance[i] = 0.0f;
+      heap.push_back({0.0f, i}); // All equal, so still a heap
+    }
+  }
+
+  const int dx[] = {0, 0, -1, 1};
+  const int dy[] = {-1, 1, 0, 0};
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    float d = heap.back().first;
+    int idx = heap.back().second;
+    heap.pop_back();
+    if (d > m_distance[idx])
+      continue; // Stale entry
+
+    int x = idx % w;
+    int y = idx / w;
+    for (int k = 0; k < 4; ++k) {
+      int nx = x + dx[k];
+      int ny = y + dy[k];
+      if (nx < 0 || nx >= w || ny < 0 || ny >= h)
+        continue;
+      int nidx = ny * w + nx;
+      if (data[nidx] != 0)
+        continue;
+      float nd = d + m_cost[nidx];
+      if (m_distance[nidx] == unreached || nd < m_distance[nidx]) {
+        m_distance[nidx] = nd;
+        heap.push_back({nd, nidx});
+        std::push_heap(heap.begin(), heap.end(), later);
+      }
+    }
+  }
+
+  // Each cell points down the distance slope: towards every closer
+  // neighbour, weighted by how much closer it is.
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      int idx = y * w + x;
+      float d = m_distance[idx];
+      if (d == unreached) {
+        field[idx] = {0.0f, 0.0f};
+        continue;
+      }
+
+      float vecX = 0;
+      float vecY = 0;
+      for (int k = 0; k < 4; ++k) {
+        int nx = x + dx[k];
+        int ny = y + dy[k];
+        if (nx < 0 || nx >= w || ny < 0 || ny >= h)
+          continue;
+        float nd = m_distance[ny * w + nx];
+        if (nd != unreached && nd < d) {
+          vecX += dx[k] * (d - nd);
+          vecY += dy[k] * (d - nd);
+        }
+      }
+
+      float len = std::sqrt(vecX * vecX + vecY * vecY);
+      if (len > 0)
+        field[idx] = {vecX / len, vecY / len};
+      else
+        field[idx] = {0.0f, 0.0f};
+    }
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "Map.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Flow field that routes around crowds. The static field from
+// Map::calculateFlowField sends every zombie down the same shortest path,
+// so one street jams while parallel ones stay empty.
+//
+// The simulation hands in its zombies every few ticks; those barely moving
+// are binned into coarse blocks. A background thread turns their density
+// into an extra cost for stepping through each cell, runs Dijkstra from the
+// goals over those costs and derives a direction per cell, all into the back
+// buffer. Publishing swaps the front index with one atomic store, so the
+// simulation never waits for a build and never sees half of one.
+//
+// Only one build is in flight at a time; positions handed in while the
+// previous build is still running are dropped.
+class CongestionField {
+public:
+  explicit CongestionField(const Map *map);
+  ~CongestionField();
+
+  // Simulation thread. Returns false if a build is still running.
+  template <typename Particles> bool submit(const Particles &particles);
+
+  // Simulation thread. The field to steer by, or nullptr before the first
+  // build lands. Stays valid until the next submit() that returns true.
+  const Map::Vector2 *current() const {
+    int front = m_front.load(std::memory_order_acquire);
+    return front < 0 ? nullptr : m_fields[front].data();
+  }
+
+  int getBuildCount() const {
+    return m_builds.load(std::memory_order_relaxed);
+  }
+  // ms
+  float getLastBuildTime() const {
+    return m_lastBuildTime.load(std::memory_order_relaxed);
+  }
+
+  // Cost of stepping into a cell is 1 + kWeight * (jammed zombies per cell
+  // in its block), so a street jammed at one zombie per cell counts
+  // kWeight + 1 times as long as a clear one. Counting every zombie instead
+  // of the jammed ones sent crowds on detours around streets that were busy
+  // but flowing, and sank fewer.
+  static constexpr float kWeight = 4.0f;
+  static constexpr float kJamSpeed = 2.0f; // Cells/s
+
+  static const int kBlock = 4; // Map cells per density block side
+
+private:
+  const Map *m_map;
+  int m_width;
+  int m_height;
+  int m_blocksX;
+  int m_blocksY;
+
+  std::vector<int> m_counts; // Jammed zombies per block, from submit()
+  std::vector<float> m_cost;
+  std::vector<float> m_distance;
+  std::vector<std::pair<float, int>> m_heap;
+  std::vector<Map::Vector2> m_fields[2];
+  std::atomic<int> m_front; // -1 until the first build
+  std::atomic<int> m_builds;
+  std::atomic<float> m_lastBuildTime;
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_pending;          // Guarded by m_mutex
+  bool m_quit;             // Guarded by m_mutex
+  std::atomic<bool> m_busy; // From submit() until the build is published
+
+  void start();
+  void run();
+  void build(std::vector<Map::Vector2> &field);
+};
+
+template <typename Particles>
+bool CongestionField::submit(const Particles &particles) {
+  if (m_busy.load(std::memory_order_acquire))
+    return false;
+
+  std::fill(m_counts.begin(), m_counts.end(), 0);
+  for (const auto &p : particles) {
+    float x = p.x;
+    float y = p.y;
+    float vx = p.vx;
+    float vy = p.vy;
+    if (vx * vx + vy * vy >= kJamSpeed * kJamSpeed)
+      continue; // Moving along; a busy street that flows is no jam
+    int bx = std::max(0, std::min(m_blocksX - 1, (int)x / kBlock));
+    int by = std::max(0, std::min(m_blocksY - 1, (int)y / kBlock));
+    m_counts[by * m_blocksX + bx]++;
+  }
+
+  m_busy.store(true, std::memory_order_relaxed);
+  if (!m_thread.joinable())
+    start();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending = true;
+  }
+  m_wake.notify_one();
+  return true;
+}
@@ -0,0 +1,316 @@
+#include "DistributedSimulation.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Rows on each side of a strip edge mirrored to the neighbour as ghosts.
+// Separation looks one grid cell (4 px) around a zombie, plus its size.
+static const int kHaloRows = 8;
+
+struct TickCommand {
+  int quit;
+  float dt;
+  float zombieSize;
+  int globalCount; // Particles alive across all strips after the last tick
+  int wantSnapshot;
+};
+
+struct TickResult {
+  int scoreDelta;
+  int particleCount;
+  int snapshotCount; // Particles following this header
+};
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool readAll(int fd, void *data, size_t size) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Particles (plain or typed) are POD and both ends run the same binary, so
+// they go over the wire as raw bytes behind a count.
+template <typename T>
+static bool sendParticles(int fd, const std::vector<T> &particles) {
+  uint32_t count = particles.size();
+  if (!writeAll(fd, &count, sizeof(count)))
+    return false;
+  return writeAll(fd, particles.data(), count * sizeof(T));
+}
+
+template <typename T>
+static bool recvParticles(int fd, std::vector<T> &particles) {
+  uint32_t count;
+  if (!readAll(fd, &count, sizeof(count)))
+    return false;
+  size_t offset = particles.size();
+  particles.resize(offset + count);
+  return readAll(fd, particles.data() + offset, count * sizeof(T));
+}
+
+// Swap particle lists with a neighbour, appending what it sends to `in`.
+// The upper strip of each pair sends first and the lower one receives first,
+// so a full socket buffer can never leave both sides blocked in write().
+static bool exchange(int fd, const std::vector<TypedParticle> &out,
+                     std::vector<TypedParticle> &in, bool sendFirst) {
+  if (fd < 0)
+    return true;
+  if (sendFirst) {
+    return sendParticles(fd, out) && recvParticles(fd, in);
+  }
+  return recvParticles(fd, in) && sendParticles(fd, out);
+}
+
+DistributedSimulation::DistributedSimulation(Map *map, int workerCount)
+    : m_map(map), m_workerCount(workerCount), m_seed(std::rand()),
+      m_config{0.0f, 0.0f, 0.0f, NeighborStrategy::Grid, -1.0f, 32, false, {}},
+      m_score(0), m_particleCount(0), m_zombieSize(1.0f),
+      m_wantSnapshot(false) {}
+
+DistributedSimulation::~DistributedSimulation() { shutdown(); }
+
+bool DistributedSimulation::init(int particleCount) {
+  int h = m_map->getHeight();
+
+  // Every strip must be at least as tall as the halo it mirrors
+  int workerCount = std::max(1, std::min(m_workerCount, h / kHaloRows));
+
+  // A dead worker should surface as a failed write, not kill the coordinator
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<int> coordSockets(workerCount * 2);
+  std::vector<int> neighborSockets((workerCount - 1) * 2);
+  for (int k = 0; k < workerCount; ++k) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, &coordSockets[k * 2]) != 0) {
+      printf("Failed to create worker socket: %s\n", strerror(errno));
+      return false;
+    }
+  }
+  for (int k = 0; k + 1 < workerCount; ++k) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, &neighborSockets[k * 2]) != 0) {
+      printf("Failed to create neighbour socket: %s\n", strerror(errno));
+      return false;
+    }
+  }
+
+  // A single simulation spreads its initial crowd evenly over open cells, so
+  // each strip gets a share in proportion to its open cells, not its rows.
+  // Cumulative counts make the shares add up to exactly particleCount.
+  int w = m_map->getWidth();
+  const auto &data = m_map->getData();
+  std::vector<long long> openBefore(h + 1, 0);
+  for (int y = 0; y < h; ++y) {
+    int open = 0;
+    for (int x = 0; x < w; ++x) {
+      if (data[y * w + x] == 0)
+        open++;
+    }
+    openBefore[y + 1] = openBefore[y] + open;
+  }
+  long long openTotal = std::max(1LL, openBefore[h]);
+
+  // One spawn stream for the whole run; everything else each worker rolls
+  // for itself
+  std::minstd_rand seeds(m_seed);
+  unsigned int spawnSeed = seeds();
+  for (int k = 0; k < workerCount; ++k) {
+    Worker worker;
+    worker.rowBegin = h * k / workerCount;
+    worker.rowEnd = h * (k + 1) / workerCount;
+    worker.socket = coordSockets[k * 2];
+
+    int share = particleCount * openBefore[worker.rowEnd] / openTotal -
+                particleCount * openBefore[worker.rowBegin] / openTotal;
+    unsigned int seed = seeds();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      printf("Failed to fork worker %d: %s\n", k, strerror(errno));
+      return false;
+    }
+    if (pid == 0) {
+      // Pair k-1 links worker k-1 (end 0) with worker k (end 1)
+      int up = (k > 0) ? neighborSockets[(k - 1) * 2 + 1] : -1;
+      int down = (k + 1 < workerCount) ? neighborSockets[k * 2] : -1;
+      int coordinator = coordSockets[k * 2 + 1];
+
+      for (int fd : coordSockets) {
+        if (fd != coordinator)
+          close(fd);
+      }
+      for (int fd : neighborSockets) {
+        if (fd != up && fd != down)
+          close(fd);
+      }
+
+      runWorker(m_map, m_config, coordinator, up, down, worker.rowBegin,
+                worker.rowEnd, share, seed, spawnSeed);
+      _exit(0);
+    }
+
+    worker.pid = pid;
+    m_workers.push_back(worker);
+  }
+
+  // The coordinator keeps only its own ends
+  for (int k = 0; k < workerCount; ++k) {
+    close(coordSockets[k * 2 + 1]);
+  }
+  for (int fd : neighborSockets) {
+    close(fd);
+  }
+
+  m_particleCount = particleCount;
+  printf("Distributed simulation: %d workers\n", workerCount);
+  return true;
+}
+
+void DistributedSimulation::update(float dt) {
+  if (m_workers.empty())
+    return;
+
+  TickCommand cmd;
+  cmd.quit = 0;
+  cmd.dt = dt;
+  cmd.zombieSize = m_zombieSize;
+  cmd.globalCount = m_particleCount;
+  cmd.wantSnapshot = m_wantSnapshot ? 1 : 0;
+
+  for (const auto &worker : m_workers) {
+    if (!writeAll(worker.socket, &cmd, sizeof(cmd))) {
+      printf("Lost worker %d\n", (int)worker.pid);
+      shutdown();
+      return;
+    }
+  }
+
+  if (m_wantSnapshot)
+    m_snapshot.clear();
+
+  int total = 0;
+  for (const auto &worker : m_workers) {
+    TickResult result;
+    bool ok = readAll(worker.socket, &result, sizeof(result));
+    if (ok && result.snapshotCount > 0)
+      ok = recvParticles(worker.socket, m_snapshot);
+    if (!ok) {
+      printf("Lost worker %d\n", (int)worker.pid);
+      shutdown();
+      return;
+    }
+    m_score += result.scoreDelta;
+    total += result.particleCount;
+  }
+
+  m_particleCount = total;
+  m_wantSnapshot = false;
+}
+
+void DistributedSimulation::shutdown() {
+  TickCommand cmd = {1, 0.0f, 0.0f, 0, 0};
+  for (const auto &worker : m_workers) {
+    writeAll(worker.socket, &cmd, sizeof(cmd));
+    close(worker.socket);
+  }
+  for (const auto &worker : m_workers) {
+    waitpid(worker.pid, nullptr, 0);
+  }
+  m_workers.clear();
+}
+
+void DistributedSimulation::runWorker(Map *map, const WorkerConfig &config,
+                                      int coordinator, int upSocket,
+                                      int downSocket, int rowBegin, int rowEnd,
+                                      int particleCount, unsigned int seed,
+                                      unsigned int spawnSeed) {
+  // Every domain rolls the same spawn attempts (see Simulation::update)
+  Simulation sim(map);
+  sim.setSeed(seed);
+  sim.setSpawnSeed(spawnSeed);
+  sim.setDomain(rowBegin, rowEnd);
+  sim.setTypeMix(config.runners, config.brutes, config.crawlers);
+  sim.setNeighborStrategy(config.strategy);
+  if (config.verletSkin >= 0.0f)
+    sim.setVerletSkin(config.verletSkin);
+  sim.setReorderInterval(config.reorderInterval);
+  if (config.viewSet)
+    sim.setUpdateView(config.view);
+  sim.init(particleCount);
+
+  int reportedScore = 0;
+  std::vector<TypedParticle> up, down, incoming;
+
+  while (true) {
+    TickCommand cmd;
+    if (!readAll(coordinator, &cmd, sizeof(cmd)) || cmd.quit)
+      break;
+
+    sim.setZombieSize(cmd.zombieSize);
+    sim.setRemoteParticleCount(cmd.globalCount - sim.getParticleCount());
+
+    // 1. Ghost zones: mirror particles near each edge to that neighbour
+    up.clear();
+    down.clear();
+    incoming.clear();
+    sim.collectHalo(kHaloRows, up, down);
+    if (!exchange(downSocket, down, incoming, true) ||
+        !exchange(upSocket, up, incoming, false))
+      break;
+    sim.setGhosts(incoming);
+
+    sim.update(cmd.dt);
+
+    // 2. Migration: hand over zombies that left the strip
+    up.clear();
+    down.clear();
+    incoming.clear();
+    sim.extractMigrants(up, down);
+    if (!exchange(downSocket, down, incoming, true) ||
+        !exchange(upSocket, up, incoming, false))
+      break;
+    sim.addParticles(incoming);
+
+    TickResult result;
+    result.scoreDelta = sim.getScore() - reportedScore;
+    result.particleCount = sim.getParticleCount();
+    result.snapshotCount = cmd.wantSnapshot ? sim.getParticleCount() : 0;
+    reportedScore = sim.getScore();
+
+    if (!writeAll(coordinator, &result, sizeof(result)))
+      break;
+    if (result.snapshotCount > 0 &&
+        !sendParticles(coordinator, sim.getParticles()))
+      break;
+  }
+
+  close(coordinator);
+  if (upSocket >= 0)
+    close(upSocket);
+  if (downSocket >= 0)
+    close(downSocket);
+}
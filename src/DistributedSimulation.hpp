@@ -0,0 +1,85 @@
+#pragma once
+#include "Map.hpp"
+#include "Simulation.hpp"
+#include <sys/types.h>
+#include <vector>
+
+// Runs the simulation split across worker processes, one per horizontal strip
+// of the map. Workers are forked from the coordinator after the map is
+// loaded, so they share its (read-only) map data copy-on-write.
+//
+// Each tick a worker swaps halo particles with its neighbours over Unix
+// socket pairs, updates its strip, then hands zombies that crossed a strip
+// edge to the neighbour that now owns them. The coordinator only merges
+// scores, particle counts and, on request, a snapshot for rendering.
+class DistributedSimulation {
+public:
+  DistributedSimulation(Map *map, int workerCount);
+  ~DistributedSimulation();
+
+  bool init(int particleCount);
+  void update(float dt);
+  void shutdown();
+
+  // Worker seeds are drawn from this (before init()); std::rand() unless set
+  void setSeed(unsigned int seed) { m_seed = seed; }
+  void setZombieSize(float size) { m_zombieSize = size; }
+
+  // Crowd options for every worker's Simulation (before init()). Verlet
+  // falls back to the grid on strips with neighbours, as ghosts change
+  // every tick.
+  void setTypeMix(float runners, float brutes, float crawlers) {
+    m_config.runners = runners;
+    m_config.brutes = brutes;
+    m_config.crawlers = crawlers;
+  }
+  void setNeighborStrategy(NeighborStrategy strategy) {
+    m_config.strategy = strategy;
+  }
+  void setVerletSkin(float skin) { m_config.verletSkin = skin; }
+  void setReorderInterval(int ticks) { m_config.reorderInterval = ticks; }
+  void setUpdateView(const ViewRect &view) {
+    m_config.view = view;
+    m_config.viewSet = true;
+  }
+  // Ask workers to send their particles with the next update()
+  void requestSnapshot() { m_wantSnapshot = true; }
+
+  int getScore() const { return m_score; }
+  int getParticleCount() const { return m_particleCount; }
+  int getWorkerCount() const { return m_workers.size(); }
+  const std::vector<Particle> &getSnapshot() const { return m_snapshot; }
+
+private:
+  struct Worker {
+    pid_t pid;
+    int socket; // Coordinator end
+    int rowBegin;
+    int rowEnd;
+  };
+
+  struct WorkerConfig {
+    float runners, brutes, crawlers;
+    NeighborStrategy strategy;
+    float verletSkin; // < 0 keeps the Simulation default
+    int reorderInterval;
+    bool viewSet;
+    ViewRect view;
+  };
+
+  Map *m_map;
+  int m_workerCount;
+  unsigned int m_seed;
+  WorkerConfig m_config;
+  std::vector<Worker> m_workers;
+  int m_score;
+  int m_particleCount;
+  float m_zombieSize;
+  bool m_wantSnapshot;
+  std::vector<Particle> m_snapshot;
+
+  static void runWorker(Map *map, const WorkerConfig &config, int coordinator,
+                        int upSocket, int downSocket, int rowBegin,
+                        int rowEnd, int particleCount, unsigned int seed,
+                        unsigned int spawnSeed);
+};
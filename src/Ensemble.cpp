@@ -0,0 +1,180 @@
+#include "Ensemble.hpp"
+#include "Instrumentation.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Parses a sysfs CPU list such as "0-3,8-11"
+static std::vector<int> parseCpuList(const char *text) {
+  std::vector<int> cpus;
+  while (*text) {
+    char *end;
+    long first = std::strtol(text, &end, 10);
+    if (end == text)
+      break;
+    long last = first;
+    text = end;
+    if (*text == '-') {
+      last = std::strtol(text + 1, &end, 10);
+      text = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu)
+      cpus.push_back((int)cpu);
+    if (*text == ',')
+      text++;
+  }
+  return cpus;
+}
+
+// CPUs of each NUMA node, indexed by node number; empty where the system
+// doesn't say
+static std::vector<std::vector<int>> readNumaNodes() {
+  std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+  for (int node = 0;; ++node) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE *file = fopen(path, "r");
+    if (!file)
+      break;
+    char text[4096];
+    nodes.push_back(fgets(text, sizeof(text), file) ? parseCpuList(text)
+                                                     : std::vector<int>());
+    fclose(file);
+  }
+#endif
+  return nodes;
+}
+
+Ensemble::Ensemble(const Map *map, int threadCount)
+    : m_map(map), m_threadCount(threadCount) {
+  if (m_threadCount <= 0)
+    m_threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+  m_nodeCpus = readNumaNodes();
+}
+
+int Ensemble::placeWorker(int worker) const {
+  // Deal workers out round-robin over the nodes that have CPUs. A single
+  // node has nothing to gain, so the scheduler keeps a free hand there.
+  std::vector<int> nodes;
+  for (int node = 0; node < (int)m_nodeCpus.size(); ++node) {
+    if (!m_nodeCpus[node].empty())
+      nodes.push_back(node);
+  }
+  if (nodes.size() < 2)
+    return -1;
+  int node = nodes[worker % nodes.size()];
+
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : m_nodeCpus[node]) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return -1;
+  return node;
+#else
+  return -1;
+#endif
+}
+
+std::vector<EnsembleResult>
+Ensemble::run(const std::vector<EnsembleRun> &runs) {
+  const float dt = 1.0f / 60.0f;
+  std::vector<EnsembleResult> results(runs.size());
+  std::atomic<int> next(0);
+
+  // Dedicated threads rather than runParallel, which would run (and pin)
+  // one share on the caller's thread
+  int threadCount = std::min<int>(m_threadCount, runs.size());
+  std::vector<std::thread> workers;
+  for (int worker = 0; worker < threadCount; ++worker) {
+    workers.emplace_back([&, worker] {
+      int node = placeWorker(worker);
+      while (true) {
+        int index = next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= (int)runs.size())
+          break;
+        const EnsembleRun &run = runs[index];
+
+        // The ensemble is parallel across runs, so each run keeps to its
+        // worker's thread (and NUMA node)
+        Simulation sim(m_map);
+        sim.setThreadCount(1);
+        sim.setSeed(run.seed);
+        sim.setTypeMix(run.runners, run.brutes, run.crawlers);
+        sim.setNeighborStrategy(run.strategy);
+        sim.setCongestionInterval(run.congestion);
+        sim.init(run.particleCount);
+
+        double start = Instrumentation::now();
+        for (int t = 0; t < run.ticks; ++t)
+          sim.update(dt);
+        double elapsed = Instrumentation::now() - start;
+
+        EnsembleResult &result = results[index];
+        result.run = run;
+        result.score = sim.getScore();
+        result.particleCount = sim.getParticleCount();
+        result.goalScores.resize(m_map->getGoalCount());
+        for (int g = 0; g < m_map->getGoalCount(); ++g)
+          result.goalScores[g] = sim.getGoalScore(g);
+        result.meanTickTime = run.ticks > 0 ? elapsed / run.ticks : 0.0;
+        result.worker = worker;
+        result.node = node;
+      }
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  return results;
+}
+
+void Ensemble::printReport(const std::vector<EnsembleResult> &results,
+                           FILE *out) {
+  fprintf(out, "%5s %10s %6s %9s %14s %5s %7s %8s %7s %6s %4s\n", "run",
+          "seed", "ticks", "particles", "mix r/b/c", "cong", "score",
+          "alive", "tick ms", "worker", "node");
+  double sum = 0.0;
+  double sumSq = 0.0;
+  int lowest = 0;
+  int highest = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const EnsembleResult &r = results[i];
+    fprintf(out,
+            "%5d %10u %6d %9d %4.2f/%4.2f/%4.2f %5d %7d %8d %7.3f %6d %4d",
+            (int)i, r.run.seed, r.run.ticks, r.run.particleCount,
+            r.run.runners, r.run.brutes, r.run.crawlers, r.run.congestion,
+            r.score, r.particleCount, r.meanTickTime, r.worker, r.node);
+    if (r.goalScores.size() > 1) {
+      fprintf(out, " goals");
+      for (size_t g = 0; g < r.goalScores.size(); ++g)
+        fprintf(out, "%c%d", g == 0 ? ' ' : '/', r.goalScores[g]);
+    }
+    fprintf(out, "\n");
+
+    sum += r.score;
+    sumSq += (double)r.score * r.score;
+    lowest = i == 0 ? r.score : std::min(lowest, r.score);
+    highest = i == 0 ? r.score : std::max(highest, r.score);
+  }
+
+  int n = results.size();
+  if (n == 0)
+    return;
+  double mean = sum / n;
+  double sd = n > 1 ? std::sqrt(std::max(0.0, (sumSq - n * mean * mean) /
+                                                  (n - 1)))
+                    : 0.0;
+  fprintf(out, "score over %d runs: mean %.1f, sd %.1f, min %d, max %d\n", n,
+          mean, sd, lowest, highest);
+}
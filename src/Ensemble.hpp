@@ -0,0 +1,61 @@
+#pragma once
+#include "Map.hpp"
+#include "Simulation.hpp"
+#include <cstdio>
+#include <vector>
+
+// One simulation of an ensemble: its seed and crowd parameters
+struct EnsembleRun {
+  unsigned int seed = 1;
+  int ticks = 600;
+  int particleCount = 5000;
+  float runners = 0.0f, brutes = 0.0f, crawlers = 0.0f;
+  int congestion = 0; // Congestion field interval, 0 = off
+  NeighborStrategy strategy = NeighborStrategy::Grid;
+};
+
+struct EnsembleResult {
+  EnsembleRun run;
+  int score;
+  int particleCount; // At the end
+  std::vector<int> goalScores;
+  double meanTickTime; // ms
+  int worker;
+  int node; // NUMA node the worker was placed on, -1 if not pinned
+};
+
+// Many independent simulations of one map, e.g. a few hundred seeds when
+// tuning spawn rates and crowd parameters. The map (walls, speeds, goals,
+// flow and distance fields) is built once by the caller and only read, so
+// every simulation shares the one copy instead of each run loading assets
+// and rebuilding the fields.
+//
+// A fixed pool of worker threads takes runs off a shared counter until none
+// are left, so short and long runs balance out. On Linux the workers are
+// spread over the NUMA nodes and pinned to their node's CPUs; a simulation
+// is created on the worker that runs it, so its particles and grid are
+// allocated on that node. The map stays wherever it was built, but it is
+// only read and sits in every node's cache after the first ticks.
+class Ensemble {
+public:
+  // threadCount 0 = one worker per hardware thread
+  explicit Ensemble(const Map *map, int threadCount = 0);
+
+  // Blocks until every run is done. Results come back in run order.
+  std::vector<EnsembleResult> run(const std::vector<EnsembleRun> &runs);
+
+  // One line per run plus score statistics over all of them
+  static void printReport(const std::vector<EnsembleResult> &results,
+                          FILE *out);
+
+  int getThreadCount() const { return m_threadCount; }
+  int getNodeCount() const { return m_nodeCpus.size(); }
+
+private:
+  const Map *m_map;
+  int m_threadCount;
+  std::vector<std::vector<int>> m_nodeCpus; // CPUs per NUMA node
+
+  // Pins the calling thread to a node's CPUs; returns the node, or -1
+  int placeWorker(int worker) const;
+};
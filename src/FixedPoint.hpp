@@ -0,0 +1,48 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+// Compact number formats for particle storage (ZOMBIE_COMPACT_PARTICLES).
+// Both convert implicitly to and from float, so simulation code reads the
+// same with either layout. Stores round to nearest and saturate at the
+// ends of the range instead of wrapping.
+
+// Signed 16.16 fixed point: +-32768 px at 1/65536 px resolution, enough
+// for 16k-pixel maps with finer steps than a float has at that size.
+struct Fixed16_16 {
+  int32_t raw;
+
+  Fixed16_16() = default;
+  Fixed16_16(float value) : raw(toRaw(value)) {}
+  operator float() const { return raw * (1.0f / 65536.0f); }
+
+  static int32_t toRaw(float value) {
+    double scaled = std::nearbyint((double)value * 65536.0);
+    if (scaled > INT32_MAX)
+      return INT32_MAX;
+    if (scaled < INT32_MIN)
+      return INT32_MIN;
+    return (int32_t)scaled;
+  }
+};
+
+// int16 with one global scale. Zombie speeds stay within the fastest
+// archetype's maxSpeed (runners, 16 px/s), so +-32 px/s leaves headroom at
+// about 0.001 px/s resolution.
+struct PackedVelocity {
+  static constexpr float kRange = 32.0f;
+  int16_t raw;
+
+  PackedVelocity() = default;
+  PackedVelocity(float value) : raw(toRaw(value)) {}
+  operator float() const { return raw * (kRange / 32767.0f); }
+
+  static int16_t toRaw(float value) {
+    float scaled = std::nearbyint(value * (32767.0f / kRange));
+    if (scaled > 32767.0f)
+      return 32767;
+    if (scaled < -32767.0f)
+      return -32767;
+    return (int16_t)scaled;
+  }
+};
@@ -0,0 +1,32 @@
+#include "FrameArena.hpp"
+#include <algorithm>
+#include <cstdint>
+
+void *FrameArena::allocateBytes(size_t size, size_t align) {
+  size_t offset = (m_offset + align - 1) & ~(align - 1);
+  if (offset + size <= m_capacity) {
+    m_offset = offset + size;
+    return m_block.get() + offset;
+  }
+
+  // Out of room for this frame. Earlier allocations must stay put, so the
+  // block can't grow in place; park this one separately until reset().
+  m_overflow.emplace_back(new unsigned char[size + align]);
+  m_overflowSize += size + align;
+  uintptr_t p = (uintptr_t)m_overflow.back().get();
+  return (void *)((p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void FrameArena::reset() {
+  size_t used = m_offset + m_overflowSize;
+  m_peak = std::max(m_peak, used);
+
+  if (!m_overflow.empty()) {
+    // Headroom so a slowly growing crowd doesn't regrow every few frames
+    m_capacity = m_peak + m_peak / 2;
+    m_block.reset(new unsigned char[m_capacity]);
+    m_overflow.clear();
+    m_overflowSize = 0;
+  }
+  m_offset = 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Linear allocator for scratch data that only lives for one tick or one
+// render pass. allocate() bumps an offset; reset() drops everything at once.
+//
+// When a frame needs more than the current block, overflow goes to extra
+// blocks and the next reset() replaces them all with one block big enough
+// for the whole frame, so the steady state stays off the heap.
+//
+// Only trivially copyable types belong in here: nothing is constructed or
+// destroyed.
+class FrameArena {
+public:
+  FrameArena() : m_capacity(0), m_offset(0), m_overflowSize(0), m_peak(0) {}
+
+  template <typename T> T *allocate(size_t count) {
+    return static_cast<T *>(allocateBytes(count * sizeof(T), alignof(T)));
+  }
+
+  void reset();
+
+  size_t getCapacity() const { return m_capacity; }
+  size_t getPeak() const { return m_peak; } // Largest frame so far, in bytes
+
+private:
+  std::unique_ptr<unsigned char[]> m_block;
+  size_t m_capacity;
+  size_t m_offset;
+
+  std::vector<std::unique_ptr<unsigned char[]>> m_overflow;
+  size_t m_overflowSize;
+  size_t m_peak;
+
+  void *allocateBytes(size_t size, size_t align);
+};
@@ -1,23 +1,32 @@
 #include "Game.hpp"
+#include "ImageStream.hpp"
+#include "Instrumentation.hpp"
 #include <SDL_image.h>
 #include <SDL_opengl.h>
 
 Game::Game()
     : m_isRunning(false), m_window(nullptr), m_glContext(nullptr),
       m_map(nullptr), m_zoom(2.0f), m_offsetX(0.0f), m_offsetY(0.0f),
-      m_simulation(nullptr), m_paused(false), m_dragging(false),
-      m_simSpeed(1.0f), m_zombieSize(1.0f) {
+      m_simulation(nullptr), m_metrics(nullptr), m_simThread(nullptr),
+      m_sentView{0, 0, 0, 0}, m_heatmap(nullptr), m_qualityPending(false),
+      m_paused(false), m_showMask(false), m_showHeatmap(false),
+      m_dragging(false), m_dragStartX(0), m_dragStartY(0), m_simSpeed(1.0f),
+      m_zombieSize(1.0f), m_loading(false), m_firstFrameLogged(false),
+      m_initStart(0.0), m_bgSurface(nullptr), m_bgDone(false),
+      m_spriteDone(false), m_loadSteps(0) {
   // Initialize UI layout
   m_speedBar = {10, 10, 200, 20};
   m_sizeBar = {10, 40, 200, 20};
   m_pauseButton = {220, 10, 60, 50};
   m_maskButton = {290, 10, 60, 50};
+  m_heatmapButton = {360, 10, 60, 50};
 }
 
 Game::~Game() {}
 
 bool Game::init(const char *title, int xpos, int ypos, int width, int height,
                 bool fullscreen) {
+  m_initStart = Instrumentation::now();
   int flags = SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN |
               SDL_WINDOW_RESIZABLE; // Ensure SHOWN is set
   if (fullscreen) {
@@ -60,39 +69,12 @@ bool Game::init(const char *title, int xpos, int ypos, int width, int height,
       glMatrixMode(GL_MODELVIEW);
       glLoadIdentity();
 
-      // Initialize Map
+      // Map and simulation are filled in by the loading pipeline; the first
+      // frames show a progress screen instead.
       m_map = new Map(width, height);
-      if (!m_map->load("assets/map.jpg", "assets/mask.png")) {
-        printf("Failed to load map assets!\n");
-        return false;
-      }
-
       m_simulation = new Simulation(m_map);
-
-      // Load Texture
-      SDL_Surface *surface = IMG_Load("assets/zombie1.png");
-      if (surface) {
-        GLuint tex;
-        glGenTextures(1, &tex);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        GLenum format =
-            (surface->format->BytesPerPixel == 4) ? GL_RGBA : GL_RGB;
-        glTexImage2D(GL_TEXTURE_2D, 0, format, surface->w, surface->h, 0,
-                     format, GL_UNSIGNED_BYTE, surface->pixels);
-        SDL_FreeSurface(surface);
-
-        m_simulation->setTexture(tex);
-        std::cout << "Texture loaded successfully!" << std::endl;
-      } else {
-        std::cout << "Failed to load zombie texture: " << IMG_GetError()
-                  << std::endl;
-      }
-
-      // Initialize Simulation
-      m_simulation->init(5000); // 5000 zombies
+      m_simulation->setMetrics(m_metrics);
+      startLoading();
 
       m_isRunning = true;
     } else {
@@ -118,6 +100,8 @@ void Game::handleEvents() {
         break;
       case SDLK_SPACE:
         m_paused = !m_paused;
+        if (m_simThread)
+          m_simThread->setPaused(m_paused);
         break;
       case SDLK_LEFT:
         m_offsetX += 0.1f / m_zoom;
@@ -138,6 +122,9 @@ void Game::handleEvents() {
       case SDLK_MINUS:
         m_zoom /= 1.1f;
         break;
+      case SDLK_h:
+        setShowHeatmap(!m_showHeatmap);
+        break;
       }
       break;
     case SDL_MOUSEBUTTONDOWN:
@@ -150,20 +137,31 @@ void Game::handleEvents() {
             my >= m_speedBar.y && my <= m_speedBar.y + m_speedBar.h) {
           float ratio = (float)(mx - m_speedBar.x) / m_speedBar.w;
           m_simSpeed = ratio * 2.0f; // Max speed 2x
+          if (m_simThread)
+            m_simThread->setSpeed(m_simSpeed);
         } else if (mx >= m_sizeBar.x && mx <= m_sizeBar.x + m_sizeBar.w &&
                    my >= m_sizeBar.y && my <= m_sizeBar.y + m_sizeBar.h) {
           float ratio = (float)(mx - m_sizeBar.x) / m_sizeBar.w;
           m_zombieSize = 1.0f + ratio * 2.5f; // 1.0 to 3.5
+          if (m_simThread)
+            m_simThread->setZombieSize(m_zombieSize);
         } else if (mx >= m_maskButton.x &&
                    mx <= m_maskButton.x + m_maskButton.w &&
                    my >= m_maskButton.y &&
                    my <= m_maskButton.y + m_maskButton.h) {
           m_showMask = !m_showMask;
+        } else if (mx >= m_heatmapButton.x &&
+                   mx <= m_heatmapButton.x + m_heatmapButton.w &&
+                   my >= m_heatmapButton.y &&
+                   my <= m_heatmapButton.y + m_heatmapButton.h) {
+          setShowHeatmap(!m_showHeatmap);
         } else if (mx >= m_pauseButton.x &&
                    mx <= m_pauseButton.x + m_pauseButton.w &&
                    my >= m_pauseButton.y &&
                    my <= m_pauseButton.y + m_pauseButton.h) {
           m_paused = !m_paused;
+          if (m_simThread)
+            m_simThread->setPaused(m_paused);
         } else {
           // Start Dragging
           m_dragging = true;
@@ -222,15 +220,216 @@ void Game::handleEvents() {
   }
 }
 
-void Game::update() {
-  float dt = 1.0f / 60.0f;
-  if (m_simulation && !m_paused) {
-    m_simulation->setZombieSize(m_zombieSize);
-    m_simulation->update(dt * m_simSpeed);
+// Total steps reported through m_loadSteps, for the progress bar
+static const int kLoadSteps = 5;
+
+void Game::startLoading() {
+  m_loading = true;
+
+  // The three loads run in parallel. The world thread streams the mask
+  // straight into the map arrays, needing only the background's size (read
+  // from its header), so flow-field construction overlaps with the
+  // remaining image work.
+  m_bgLoad = std::async(std::launch::async, [] {
+               double start = Instrumentation::now();
+               SDL_Surface *surface = IMG_Load("assets/map.jpg");
+               Instrumentation::log("Decoded map.jpg in %.1f ms",
+                                    Instrumentation::now() - start);
+               return surface;
+             }).share();
+
+  m_spriteLoad = std::async(std::launch::async, [] {
+    double start = Instrumentation::now();
+    SDL_Surface *surface = IMG_Load("assets/zombie1.png");
+    Instrumentation::log("Decoded zombie1.png in %.1f ms",
+                         Instrumentation::now() - start);
+    return surface;
+  });
+
+  std::shared_future<SDL_Surface *> bgLoad = m_bgLoad;
+  m_worldLoad = std::async(std::launch::async, [this, bgLoad] {
+    double start = Instrumentation::now();
+    int width, height;
+    if (readImageSize("assets/map.jpg", &width, &height) &&
+        m_map->buildStreaming(width, height, "assets/mask.png")) {
+      Instrumentation::log("Streamed mask.png into map data and built the "
+                           "flow field in %.1f ms",
+                           Instrumentation::now() - start);
+      m_loadSteps += 2;
+    } else if (!loadWorldDecoded(bgLoad)) {
+      return false;
+    }
+
+    start = Instrumentation::now();
+    m_simulation->init(5000); // 5000 zombies
+    Instrumentation::log("Seeded simulation in %.1f ms",
+                         Instrumentation::now() - start);
+    m_loadSteps++;
+    return true;
+  });
+}
+
+bool Game::loadWorldDecoded(std::shared_future<SDL_Surface *> bgLoad) {
+  double start = Instrumentation::now();
+  SDL_Surface *maskSurf = IMG_Load("assets/mask.png");
+  if (!maskSurf) {
+    printf("Failed to load map mask: %s\n", IMG_GetError());
+    return false;
   }
+  Instrumentation::log("Decoded mask.png in %.1f ms",
+                       Instrumentation::now() - start);
+  m_loadSteps++;
+
+  SDL_Surface *bgSurf = bgLoad.get();
+  if (!bgSurf) {
+    printf("Failed to load map background: %s\n", IMG_GetError());
+    SDL_FreeSurface(maskSurf);
+    return false;
+  }
+
+  start = Instrumentation::now();
+  m_map->build(bgSurf->w, bgSurf->h, maskSurf);
+  SDL_FreeSurface(maskSurf);
+  Instrumentation::log("Built map data and flow field in %.1f ms",
+                       Instrumentation::now() - start);
+  m_loadSteps++;
+  return true;
+}
+
+void Game::pollLoading() {
+  auto ready = [](const auto &future) {
+    return future.valid() && future.wait_for(std::chrono::seconds(0)) ==
+                                 std::future_status::ready;
+  };
+
+  // GL uploads for whatever finished decoding since the last frame
+  if (!m_bgDone && ready(m_bgLoad)) {
+    m_bgDone = true;
+    m_bgSurface = m_bgLoad.get();
+    if (m_bgSurface)
+      m_map->uploadBackground(m_bgSurface);
+    m_loadSteps++;
+  }
+
+  if (!m_spriteDone && ready(m_spriteLoad)) {
+    m_spriteDone = true;
+    SDL_Surface *surface = m_spriteLoad.get();
+    if (surface) {
+      GLuint tex;
+      glGenTextures(1, &tex);
+      glBindTexture(GL_TEXTURE_2D, tex);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+      GLenum format = (surface->format->BytesPerPixel == 4) ? GL_RGBA : GL_RGB;
+      glTexImage2D(GL_TEXTURE_2D, 0, format, surface->w, surface->h, 0, format,
+                   GL_UNSIGNED_BYTE, surface->pixels);
+      SDL_FreeSurface(surface);
+
+      m_simulation->setTexture(tex);
+      std::cout << "Texture loaded successfully!" << std::endl;
+    } else {
+      std::cout << "Failed to load zombie texture: " << IMG_GetError()
+                << std::endl;
+    }
+    m_loadSteps++;
+  }
+
+  // The streaming world build doesn't wait for the background, so it can
+  // finish first; the background still has to be uploaded (and freed)
+  if (!ready(m_worldLoad) || !m_spriteDone || !m_bgDone)
+    return;
+
+  bool ok = m_worldLoad.get();
+  if (ok && !m_bgSurface) {
+    printf("Failed to load map background: %s\n", IMG_GetError());
+    ok = false;
+  }
+  // The world thread was the last reader of the background surface
+  if (m_bgSurface) {
+    SDL_FreeSurface(m_bgSurface);
+    m_bgSurface = nullptr;
+  }
+  m_bgLoad = std::shared_future<SDL_Surface *>();
+  if (!ok) {
+    printf("Failed to load map assets!\n");
+    m_isRunning = false;
+    return;
+  }
+
+  m_loading = false;
+  Instrumentation::log("Loading finished after %.1f ms",
+                       Instrumentation::now() - m_initStart);
+
+  // Controls changed during loading go over with the first commands
+  m_simThread = new SimulationThread(m_simulation);
+  m_simThread->setSpeed(m_simSpeed);
+  m_simThread->setZombieSize(m_zombieSize);
+  m_simThread->setPaused(m_paused);
+  m_simThread->setHeatmap(m_showHeatmap);
+  m_simThread->start();
+}
+
+void Game::renderLoadingScreen() {
+  glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glLoadIdentity();
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  float barW = viewport[2] * 0.5f;
+  float barH = 20.0f;
+  float x = (viewport[2] - barW) / 2;
+  float y = (viewport[3] - barH) / 2;
+  float progress = (float)m_loadSteps / kLoadSteps;
+
+  glColor3f(0.3f, 0.3f, 0.3f);
+  glRectf(x, y, x + barW, y + barH);
+  glColor3f(0.0f, 1.0f, 0.0f);
+  glRectf(x, y, x + barW * progress, y + barH);
+
+  SDL_GL_SwapWindow(m_window);
+}
+
+void Game::update() {
+  // Ticking happens on the simulation thread
+  if (m_loading)
+    pollLoading();
+}
+
+void Game::setShowHeatmap(bool show) {
+  m_showHeatmap = show;
+  // Averages from before the overlay was hidden would be stale
+  if (show && m_heatmap)
+    m_heatmap->reset();
+  if (m_simThread)
+    m_simThread->setHeatmap(show);
+}
+
+// False if the simulation thread's command ring is full; the caller tries
+// again next frame. Settings it already took are just sent again.
+bool Game::applyQuality(QualityGovernor::Level level) {
+  RenderLod lod = RenderLod::Sprites;
+  if (level >= QualityGovernor::Density)
+    lod = RenderLod::Density;
+  else if (level >= QualityGovernor::Points)
+    lod = RenderLod::Points;
+  m_simulation->setRenderLod(lod);
+
+  return m_simThread->setNeighborInterval(
+             level >= QualityGovernor::HalfRateNeighbors ? 2 : 1) &&
+         m_simThread->setJitter(level < QualityGovernor::NoJitter) &&
+         m_simThread->setMaxSubsteps(
+             level >= QualityGovernor::SingleSubstep ? 1 : 0);
 }
 
 void Game::render() {
+  if (m_loading) {
+    renderLoadingScreen();
+    return;
+  }
+  double frameStart = Instrumentation::now();
+
   glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
 
@@ -240,6 +439,20 @@ void Game::render() {
   glScalef(m_zoom, m_zoom, 1.0f);
   glTranslatef(-m_offsetX, -m_offsetY, 0.0f);
 
+  // What the camera shows, for culling here and for the simulation's update
+  // LOD. Only changes are sent, so a still camera doesn't fill the ring.
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  ViewRect view = {m_offsetX, m_offsetY, m_offsetX + viewport[2] / m_zoom,
+                   m_offsetY + viewport[3] / m_zoom};
+  if (m_simThread) {
+    m_simulation->setRenderView(view);
+    if ((view.minX != m_sentView.minX || view.minY != m_sentView.minY ||
+         view.maxX != m_sentView.maxX || view.maxY != m_sentView.maxY) &&
+        m_simThread->setView(view))
+      m_sentView = view;
+  }
+
   if (m_map) {
     m_map->render();
     if (m_showMask) {
@@ -247,8 +460,16 @@ void Game::render() {
     }
   }
 
-  if (m_simulation)
-    m_simulation->render();
+  if (m_simThread) {
+    const CrowdSnapshot &snapshot = m_simThread->acquire();
+    m_simulation->render(snapshot);
+    if (m_showHeatmap) {
+      if (!m_heatmap)
+        m_heatmap = new HeatmapOverlay();
+      m_heatmap->update(snapshot);
+      m_heatmap->render();
+    }
+  }
 
   // Render UI Overlay
   glLoadIdentity(); // Reset view for UI
@@ -258,8 +479,6 @@ void Game::render() {
   glMatrixMode(GL_PROJECTION);
   glPushMatrix();
   glLoadIdentity();
-  GLint viewport[4];
-  glGetIntegerv(GL_VIEWPORT, viewport);
   glOrtho(0, viewport[2], viewport[3], 0, -1, 1); // Top-left origin
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
@@ -299,15 +518,59 @@ void Game::render() {
   glRectf(m_maskButton.x, m_maskButton.y, m_maskButton.x + m_maskButton.w,
           m_maskButton.y + m_maskButton.h);
 
+  // Heatmap Button
+  if (m_showHeatmap)
+    glColor3f(1.0f, 0.6f, 0.2f); // Orange active
+  else
+    glColor3f(0.3f, 0.3f, 0.3f);
+  glRectf(m_heatmapButton.x, m_heatmapButton.y,
+          m_heatmapButton.x + m_heatmapButton.w,
+          m_heatmapButton.y + m_heatmapButton.h);
+
   // Restore Projection
   glMatrixMode(GL_PROJECTION);
   glPopMatrix();
   glMatrixMode(GL_MODELVIEW); // Ensure we leave in ModelView mode
 
+  // Work up to here counts against the budget; the swap may just be waiting
+  // for vsync.
+  if (m_simThread &&
+      m_governor.addFrame(Instrumentation::now() - frameStart,
+                          m_simThread->getLastTickTime()))
+    m_qualityPending = true;
+  if (m_simThread && m_qualityPending)
+    m_qualityPending = !applyQuality(m_governor.getLevel());
+
   SDL_GL_SwapWindow(m_window);
+
+  if (!m_firstFrameLogged) {
+    m_firstFrameLogged = true;
+    Instrumentation::log("First interactive frame after %.1f ms",
+                         Instrumentation::now() - m_initStart);
+  }
 }
 
 void Game::clean() {
+  // Let any loader threads finish before tearing down what they write to
+  if (m_worldLoad.valid())
+    m_worldLoad.wait();
+  if (m_spriteLoad.valid())
+    SDL_FreeSurface(m_spriteLoad.get());
+  if (m_bgLoad.valid() && !m_bgSurface)
+    m_bgSurface = m_bgLoad.get();
+  if (m_bgSurface) {
+    SDL_FreeSurface(m_bgSurface);
+    m_bgSurface = nullptr;
+  }
+  m_bgLoad = std::shared_future<SDL_Surface *>();
+
+  if (m_simThread) {
+    m_simThread->stop();
+    Instrumentation::log("Simulation thread ran %d ticks",
+                         m_simThread->getTickCount());
+    delete m_simThread;
+    m_simThread = nullptr;
+  }
   if (m_simulation) {
     delete m_simulation;
     m_simulation = nullptr;
@@ -316,6 +579,10 @@ void Game::clean() {
     delete m_map;
     m_map = nullptr;
   }
+  if (m_heatmap) {
+    delete m_heatmap;
+    m_heatmap = nullptr;
+  }
   SDL_GL_DeleteContext(m_glContext);
   SDL_DestroyWindow(m_window);
   SDL_Quit();
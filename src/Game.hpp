@@ -1,7 +1,12 @@
 #pragma once
+#include "HeatmapOverlay.hpp"
 #include "Map.hpp"
+#include "QualityGovernor.hpp"
 #include "Simulation.hpp"
+#include "SimulationThread.hpp"
 #include <SDL.h>
+#include <atomic>
+#include <future>
 #include <iostream>
 
 class Game {
@@ -18,6 +23,11 @@ public:
 
   bool running() { return m_isRunning; }
 
+  // Call before init(); the simulation reports to it once created
+  void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+  // Frame time to hold by lowering quality, ms; 0 turns the governor off
+  void setFrameBudget(double budgetMs) { m_governor.setBudget(budgetMs); }
+
 private:
   bool m_isRunning;
   SDL_Window *m_window;
@@ -30,10 +40,27 @@ private:
   float m_offsetY;
 
   Simulation *m_simulation;
+  Metrics *m_metrics;
+  // Ticks the simulation once loading is done; from then on the main thread
+  // only renders its snapshots and sends it the controls below.
+  SimulationThread *m_simThread;
+  ViewRect m_sentView; // Last view the simulation thread accepted
+
+  // Crowd density/speed overlay; the simulation only collects the data
+  // while it is shown
+  HeatmapOverlay *m_heatmap;
+  void setShowHeatmap(bool show);
+
+  QualityGovernor m_governor;
+  // The governor's level has settings the simulation thread hasn't
+  // accepted yet (its command ring was full); retried every frame
+  bool m_qualityPending;
+  bool applyQuality(QualityGovernor::Level level);
 
   // UI state
   bool m_paused;
   bool m_showMask;
+  bool m_showHeatmap;
   bool m_dragging;
   int m_dragStartX, m_dragStartY;
 
@@ -49,4 +76,26 @@ private:
   Rect m_sizeBar;
   Rect m_pauseButton;
   Rect m_maskButton;
+  Rect m_heatmapButton;
+
+  // Asynchronous startup. Image decodes, mask parsing, flow field and
+  // seeding run on worker threads; finished images are uploaded to GL on the
+  // main thread while a progress screen is shown.
+  bool m_loading;
+  bool m_firstFrameLogged;
+  double m_initStart;
+  std::shared_future<SDL_Surface *> m_bgLoad;
+  std::future<SDL_Surface *> m_spriteLoad;
+  std::future<bool> m_worldLoad;
+  SDL_Surface *m_bgSurface; // Uploaded, freed once the world is built
+  bool m_bgDone;
+  bool m_spriteDone;
+  std::atomic<int> m_loadSteps;
+
+  void startLoading();
+  // World thread fallback when the mask can't be streamed: decode it whole
+  // and wait for the background's size
+  bool loadWorldDecoded(std::shared_future<SDL_Surface *> bgLoad);
+  void pollLoading();
+  void renderLoadingScreen();
 };
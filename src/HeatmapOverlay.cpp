@@ -0,0 +1,134 @@
+#include "HeatmapOverlay.hpp"
+#include <SDL_opengl.h>
+#include <algorithm>
+
+HeatmapOverlay::HeatmapOverlay()
+    : m_textureID(0), m_width(0), m_height(0), m_cellSize(1), m_lastTick(-1),
+      m_uploadedTexels(0) {}
+
+HeatmapOverlay::~HeatmapOverlay() {
+  if (m_textureID)
+    glDeleteTextures(1, &m_textureID);
+}
+
+void HeatmapOverlay::reset() {
+  std::fill(m_density.begin(), m_density.end(), 0.0f);
+  std::fill(m_speed.begin(), m_speed.end(), 0.0f);
+  m_lastTick = -1;
+}
+
+void HeatmapOverlay::update(const CrowdSnapshot &snapshot) {
+  m_uploadedTexels = 0;
+  int w = snapshot.gridWidth;
+  int h = snapshot.gridHeight;
+  if (snapshot.cellCounts.size() != (size_t)w * h || w == 0 || h == 0 ||
+      snapshot.tick == m_lastTick)
+    return;
+  m_lastTick = snapshot.tick;
+  m_cellSize = snapshot.cellSize;
+
+  bool resized = w != m_width || h != m_height;
+  if (resized) {
+    m_width = w;
+    m_height = h;
+    m_density.assign(w * h, 0.0f);
+    m_speed.assign(w * h, 0.0f);
+    m_texels.assign(w * h, 0);
+    if (!m_textureID)
+      glGenTextures(1, &m_textureID);
+    glBindTexture(GL_TEXTURE_2D, m_textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, m_texels.data());
+  }
+
+  int tilesX = (w + kTile - 1) / kTile;
+  int tilesY = (h + kTile - 1) / kTile;
+  glBindTexture(GL_TEXTURE_2D, m_textureID);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  for (int ty = 0; ty < tilesY; ++ty) {
+    for (int tx = 0; tx < tilesX; ++tx) {
+      int x0 = tx * kTile;
+      int y0 = ty * kTile;
+      int x1 = std::min(w, x0 + kTile);
+      int y1 = std::min(h, y0 + kTile);
+
+      // Bounding box of the texels that changed in this tile
+      int dirtyX0 = x1, dirtyY0 = y1, dirtyX1 = x0, dirtyY1 = y0;
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+          int c = y * w + x;
+          int count = snapshot.cellCounts[c];
+          float speed = count > 0 ? snapshot.cellSpeeds[c] / count : 0.0f;
+          m_density[c] += (count - m_density[c]) * kSmoothing;
+          m_speed[c] += (speed - m_speed[c]) * kSmoothing;
+
+          // 16 steps each, so averages creeping towards a steady value stop
+          // dirtying the texel after a while
+          int d = (int)(15.0f * std::min(1.0f, m_density[c] / kFullDensity));
+          int v = (int)(15.0f * std::min(1.0f, m_speed[c] / kFullSpeed));
+          uint32_t r = 17 * (15 - v);
+          uint32_t g = 17 * v;
+          uint32_t a = 15 * d;
+          // Memory order R, G, B, A on a little-endian host
+          uint32_t texel = r | g << 8 | 32u << 16 | a << 24;
+          if (a == 0)
+            texel = 0;
+          if (texel != m_texels[c]) {
+            m_texels[c] = texel;
+            dirtyX0 = std::min(dirtyX0, x);
+            dirtyY0 = std::min(dirtyY0, y);
+            dirtyX1 = std::max(dirtyX1, x + 1);
+            dirtyY1 = std::max(dirtyY1, y + 1);
+          }
+        }
+      }
+
+      if (resized) {
+        dirtyX0 = x0;
+        dirtyY0 = y0;
+        dirtyX1 = x1;
+        dirtyY1 = y1;
+      }
+      if (dirtyX0 < dirtyX1) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dirtyX0, dirtyY0, dirtyX1 - dirtyX0,
+                        dirtyY1 - dirtyY0, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &m_texels[dirtyY0 * w + dirtyX0]);
+        m_uploadedTexels += (dirtyX1 - dirtyX0) * (dirtyY1 - dirtyY0);
+      }
+    }
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void HeatmapOverlay::render() const {
+  if (!m_textureID)
+    return;
+  float x1 = (float)m_width * m_cellSize;
+  float y1 = (float)m_height * m_cellSize;
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, m_textureID);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0);
+  glVertex2f(0, 0);
+  glTexCoord2f(1, 0);
+  glVertex2f(x1, 0);
+  glTexCoord2f(1, 1);
+  glVertex2f(x1, y1);
+  glTexCoord2f(0, 1);
+  glVertex2f(0, y1);
+  glEnd();
+
+  glDisable(GL_BLEND);
+  glDisable(GL_TEXTURE_2D);
+}
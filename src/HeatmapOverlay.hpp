@@ -0,0 +1,47 @@
+#pragma once
+#include "Simulation.hpp"
+#include <cstdint>
+#include <vector>
+
+// Live crowd heatmap drawn over the map: one texel per simulation grid
+// cell, more opaque the more zombies it holds, red where they stand still
+// shading to green where they move at full pace. Jams show up as solid red.
+//
+// Each new snapshot is blended into running averages so single ticks don't
+// flicker. Texels are compared with what was uploaded last; per tile, only
+// the rectangle around the changed ones goes to the GPU with
+// glTexSubImage2D, so a crowd that has settled costs next to nothing.
+// Render thread only.
+class HeatmapOverlay {
+public:
+  HeatmapOverlay();
+  ~HeatmapOverlay();
+
+  // Blends in a snapshot (with heatmap data, see Simulation::setHeatmap)
+  // and uploads what changed. A tick already seen is skipped, so calling
+  // this every frame is fine.
+  void update(const CrowdSnapshot &snapshot);
+  // In map cell coordinates, like Map::render
+  void render() const;
+  // Drop the averages, e.g. when the overlay is switched back on
+  void reset();
+
+  int getUploadedTexels() const { return m_uploadedTexels; } // Last update
+
+private:
+  static const int kTile = 16;               // Texels per upload tile side
+  static constexpr float kSmoothing = 0.1f;  // Weight of each new tick
+  static constexpr float kFullDensity = 6.0f; // Zombies per cell for opaque
+  static constexpr float kFullSpeed = 6.0f;   // Cells/s for full green
+
+  unsigned int m_textureID;
+  int m_width;
+  int m_height;
+  int m_cellSize;
+  int m_lastTick;
+  int m_uploadedTexels;
+
+  std::vector<float> m_density; // Smoothed zombies per cell
+  std::vector<float> m_speed;   // Smoothed mean speed
+  std::vector<uint32_t> m_texels; // As last uploaded, RGBA
+};
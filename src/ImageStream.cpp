@@ -0,0 +1,160 @@
+#include "ImageStream.hpp"
+#include <cstdio>
+#include <cstring>
+#include <png.h>
+
+static int readBigEndian16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+
+static bool readPNGSize(FILE *in, int *width, int *height) {
+  // Signature, then IHDR: length, type, width, height
+  unsigned char header[24];
+  if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+      png_sig_cmp(header, 0, 8) != 0 || std::memcmp(header + 12, "IHDR", 4))
+    return false;
+  *width = readBigEndian16(header + 16) << 16 | readBigEndian16(header + 18);
+  *height = readBigEndian16(header + 20) << 16 | readBigEndian16(header + 22);
+  return true;
+}
+
+static bool readJPEGSize(FILE *in, int *width, int *height) {
+  unsigned char bytes[2];
+  if (fread(bytes, 1, 2, in) != 2 || bytes[0] != 0xFF || bytes[1] != 0xD8)
+    return false;
+
+  // Walk the marker segments up to the first start-of-frame
+  while (true) {
+    int c = fgetc(in);
+    if (c != 0xFF)
+      return false;
+    int marker;
+    do {
+      marker = fgetc(in); // 0xFF may repeat as fill
+    } while (marker == 0xFF);
+    if (marker == EOF || marker == 0xD9 || marker == 0xDA)
+      return false; // End of image or scan data before any frame header
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue; // No length field
+
+    unsigned char segment[7];
+    if (fread(segment, 1, 2, in) != 2)
+      return false;
+    int length = readBigEndian16(segment);
+    bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                 marker != 0xC8 && marker != 0xCC;
+    if (frame) {
+      // Precision, height, width
+      if (length < 7 || fread(segment + 2, 1, 5, in) != 5)
+        return false;
+      *height = readBigEndian16(segment + 3);
+      *width = readBigEndian16(segment + 5);
+      return *width > 0 && *height > 0;
+    }
+    if (length < 2 || fseek(in, length - 2, SEEK_CUR) != 0)
+      return false;
+  }
+}
+
+bool readImageSize(const char *file, int *width, int *height) {
+  FILE *in = fopen(file, "rb");
+  if (!in)
+    return false;
+  bool ok = readPNGSize(in, width, height);
+  if (!ok) {
+    rewind(in);
+    ok = readJPEGSize(in, width, height);
+  }
+  fclose(in);
+  return ok;
+}
+
+namespace {
+struct PNGStream {
+  const PNGRowFn *onRow;
+  int width;
+  bool stopped; // onRow asked for no more
+  bool done;    // All rows delivered
+};
+} // namespace
+
+static void pngError(png_structp png, png_const_charp message) {
+  printf("Failed to stream %s: %s\n", (const char *)png_get_error_ptr(png),
+         message);
+  png_longjmp(png, 1);
+}
+
+static void pngWarning(png_structp, png_const_charp) {}
+
+static void pngInfo(png_structp png, png_infop info) {
+  PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png);
+  png_uint_32 width, height;
+  int bitDepth, colorType, interlace;
+  png_get_IHDR(png, info, &width, &height, &bitDepth, &colorType, &interlace,
+               nullptr, nullptr);
+  if (interlace != PNG_INTERLACE_NONE)
+    png_error(png, "interlaced images can't be streamed");
+
+  // Whatever the format, rows arrive as 8-bit RGB
+  png_set_expand(png);
+  png_set_strip_16(png);
+  png_set_strip_alpha(png);
+  png_set_gray_to_rgb(png);
+  png_read_update_info(png, info);
+  stream->width = width;
+}
+
+static void pngRow(png_structp png, png_bytep row, png_uint_32 y, int) {
+  PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png);
+  if (row && !stream->stopped && !(*stream->onRow)(y, row, stream->width))
+    stream->stopped = true;
+}
+
+static void pngEnd(png_structp png, png_infop) {
+  PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png);
+  stream->done = true;
+}
+
+bool streamPNGRows(const char *file, const PNGRowFn &onRow) {
+  FILE *in = fopen(file, "rb");
+  if (!in)
+    return false;
+  unsigned char signature[8];
+  if (fread(signature, 1, sizeof(signature), in) != sizeof(signature) ||
+      png_sig_cmp(signature, 0, sizeof(signature)) != 0) {
+    fclose(in);
+    return false;
+  }
+
+  png_structp png = png_create_read_struct(
+      PNG_LIBPNG_VER_STRING, (png_voidp)file, pngError, pngWarning);
+  png_infop info = png ? png_create_info_struct(png) : nullptr;
+  if (!info) {
+    png_destroy_read_struct(&png, nullptr, nullptr);
+    fclose(in);
+    return false;
+  }
+
+  // A small chunk keeps an early stop from reading far past the last row
+  // wanted; libpng itself holds just the current and previous row.
+  static const int kChunk = 16 * 1024;
+  unsigned char buffer[kChunk];
+  PNGStream stream = {&onRow, 0, false, false};
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_read_struct(&png, &info, nullptr);
+    fclose(in);
+    return false;
+  }
+  png_set_progressive_read_fn(png, &stream, pngInfo, pngRow, pngEnd);
+  png_process_data(png, info, signature, sizeof(signature));
+  size_t count;
+  while (!stream.stopped && !stream.done &&
+         (count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    png_process_data(png, info, buffer, count);
+
+  bool ok = stream.stopped || stream.done;
+  if (!ok)
+    printf("Failed to stream %s: file ends early\n", file);
+  png_destroy_read_struct(&png, &info, nullptr);
+  fclose(in);
+  return ok;
+}
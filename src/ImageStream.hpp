@@ -0,0 +1,22 @@
+#pragma once
+#include <functional>
+
+// Image reading that never holds a whole decoded image, for maps too big to
+// decode in one piece on small machines.
+
+// Width and height from the file header alone (PNG or baseline/progressive
+// JPEG), without decoding any pixels
+bool readImageSize(const char *file, int *width, int *height);
+
+// Called with each decoded row as 8-bit RGB triples. Return false to stop
+// decoding early, e.g. once the rows of interest are done.
+using PNGRowFn = std::function<bool(int y, const unsigned char *rgb, int width)>;
+
+// Decodes a PNG with libpng's progressive reader: the file is fed in small
+// chunks and every row goes to onRow as soon as it is complete, so memory
+// stays at a row or two whatever the image size. Palette, grey, 16-bit and
+// alpha images are converted to plain RGB. Interlaced images are refused,
+// since each pass would need the whole image kept. Returns false if the file
+// can't be streamed (not a PNG, interlaced, or corrupt); rows delivered
+// before a failure may have been used already.
+bool streamPNGRows(const char *file, const PNGRowFn &onRow);
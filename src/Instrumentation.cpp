@@ -0,0 +1,50 @@
+#include "Instrumentation.hpp"
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+
+double Instrumentation::now() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void Instrumentation::log(const char *fmt, ...) {
+  // Format into one buffer so lines from different threads do not interleave
+  char message[512];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+
+  printf("[%10.2f ms] %s\n", now(), message);
+  fflush(stdout);
+}
+
+#ifdef ZOMBIE_COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long long> g_allocations(0);
+
+// The array and nothrow forms forward to these by default with libstdc++
+// and libc++. The sized delete is replaced alongside the plain one, as
+// -Wsized-deallocation expects.
+void *operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+long long Instrumentation::allocationCount() {
+  return g_allocations.load(std::memory_order_relaxed);
+}
+#else
+long long Instrumentation::allocationCount() { return -1; }
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+// Timestamped event log on stdout. Times are milliseconds since the first
+// call, so a run's log can be grepped and lined up against another run.
+class Instrumentation {
+public:
+  static double now();
+  static void log(const char *fmt, ...);
+
+  // Heap allocations (global operator new) since startup. Only counted in
+  // builds with ZOMBIE_COUNT_ALLOCATIONS; -1 otherwise.
+  static long long allocationCount();
+};
@@ -1,16 +1,25 @@
 #include "Map.hpp"
+#include "ImageStream.hpp"
+#include "Instrumentation.hpp"
+#include "Parallel.hpp"
 #include <SDL_image.h>
 #include <SDL_opengl.h> // Include OpenGL header
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
-#include <queue> // For BFS
+#include <thread>
 
-Map::Map(int width, int height) : m_width(width), m_height(height) {
+Map::Map(int width, int height)
+    : m_width(width), m_height(height), m_flowFieldBuildTime(0.0),
+      m_defaultGoal(true), m_textureID(0), m_maskTextureID(0) {
   m_data.resize(m_width * m_height, 0);
   m_flowField.resize(m_width * m_height, {0.0f, 0.0f});
   std::srand(std::time(nullptr));
+  setDefaultGoal();
   calculateFlowField(); // Call calculateFlowField in constructor
+  calculateDistanceField();
 }
 
 Map::~Map() {}
@@ -23,10 +32,36 @@ bool Map::load(const char *bgFile, const char *maskFile) {
     return false;
   }
 
-  // Set map dimensions from background image
-  m_width = bgSurf->w;
-  m_height = bgSurf->h;
+  // Map dimensions come from the background image
+  int width = bgSurf->w;
+  int height = bgSurf->h;
+  uploadBackground(bgSurf);
+  SDL_FreeSurface(bgSurf);
+
+  return loadMask(maskFile, width, height);
+}
 
+bool Map::loadHeadless(const char *bgFile, const char *maskFile) {
+  m_textureID = 0;
+  m_maskTextureID = 0;
+
+  // Only the background dimensions are needed, and the header has them
+  int width, height;
+  if (!readImageSize(bgFile, &width, &height)) {
+    SDL_Surface *bgSurf = IMG_Load(bgFile);
+    if (!bgSurf) {
+      printf("Failed to load map background: %s\n", IMG_GetError());
+      return false;
+    }
+    width = bgSurf->w;
+    height = bgSurf->h;
+    SDL_FreeSurface(bgSurf);
+  }
+
+  return loadMask(maskFile, width, height);
+}
+
+void Map::uploadBackground(SDL_Surface *bgSurf) {
   glGenTextures(1, &m_textureID);
   glBindTexture(GL_TEXTURE_2D, m_textureID);
 
@@ -39,20 +74,95 @@ bool Map::load(const char *bgFile, const char *maskFile) {
                GL_UNSIGNED_BYTE, bgSurf->pixels);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
 
-  SDL_FreeSurface(bgSurf);
+bool Map::loadMask(const char *maskFile, int width, int height) {
+  if (buildStreaming(width, height, maskFile))
+    return true;
 
-  // Load Mask
+  // Not a PNG we can stream: decode it whole
   SDL_Surface *maskSurf = IMG_Load(maskFile);
   if (!maskSurf) {
     printf("Failed to load map mask: %s\n", IMG_GetError());
     return false;
   }
+  build(width, height, maskSurf);
+  SDL_FreeSurface(maskSurf);
+  return true;
+}
 
-  // Resize data vectors
+void Map::resizeCells(int width, int height) {
+  m_width = width;
+  m_height = height;
   m_data.resize(m_width * m_height);
   m_speedModifiers.resize(m_width * m_height);
   m_flowField.resize(m_width * m_height);
+}
+
+void Map::classifyCell(int idx, Uint8 r, Uint8 g, Uint8 b,
+                       std::vector<unsigned char> &goalCells) {
+  if (r == 0 && g == 0 && b == 0) {
+    // Black = Wall
+    m_data[idx] = 1;
+    m_speedModifiers[idx] = 0.0f;
+  } else if (b > 200 && r < 50 && g < 50) {
+    // Blue = Road / Fast
+    m_data[idx] = 0;
+    m_speedModifiers[idx] = 1.0f;
+  } else if (r > 200 && g < 50 && b < 50) {
+    // Red = Slow
+    m_data[idx] = 0;
+    m_speedModifiers[idx] = 0.5f;
+  } else if (g > 200 && r < 50 && b < 50) {
+    // Green = Goal
+    m_data[idx] = 0;
+    m_speedModifiers[idx] = 1.0f;
+    goalCells[idx] = 1;
+  } else {
+    // Other (e.g. white/noise) -> Default Walkable
+    m_data[idx] = 0;
+    m_speedModifiers[idx] = 1.0f;
+  }
+}
+
+void Map::finishBuild(const std::vector<unsigned char> &goalCells) {
+  labelGoals(goalCells);
+
+  // Recalculate AI. Both passes only read m_data, so the distance field is
+  // built alongside the flow field.
+  std::thread distanceThread([this] { calculateDistanceField(); });
+  calculateFlowField();
+  distanceThread.join();
+}
+
+bool Map::buildStreaming(int width, int height, const char *maskFile) {
+  resizeCells(width, height);
+  // Anything the mask doesn't cover is wall
+  std::fill(m_data.begin(), m_data.end(), 1);
+  std::fill(m_speedModifiers.begin(), m_speedModifiers.end(), 0.0f);
+  std::vector<unsigned char> goalCells(m_width * m_height, 0);
+
+  bool streamed = streamPNGRows(
+      maskFile, [&](int y, const unsigned char *rgb, int maskWidth) {
+        if (y >= m_height)
+          return false; // Rows below the map are never used
+        int count = std::min(maskWidth, m_width);
+        for (int x = 0; x < count; ++x) {
+          classifyCell(y * m_width + x, rgb[3 * x], rgb[3 * x + 1],
+                       rgb[3 * x + 2], goalCells);
+        }
+        return y + 1 < m_height;
+      });
+  if (!streamed)
+    return false;
+
+  finishBuild(goalCells);
+  return true;
+}
+
+void Map::build(int width, int height, SDL_Surface *maskSurf) {
+  resizeCells(width, height);
+  std::vector<unsigned char> goalCells(m_width * m_height, 0);
 
   // Parse Mask Pixels
   // Ensure we are reading correctly regardless of format.
@@ -95,36 +205,12 @@ bool Map::load(const char *bgFile, const char *maskFile) {
       Uint32 pixel = getPixel(x, y);
       Uint8 r, g, b;
       SDL_GetRGB(pixel, maskSurf->format, &r, &g, &b);
-
-      int idx = y * m_width + x;
-
-      if (r == 0 && g == 0 && b == 0) {
-        // Black = Wall
-        m_data[idx] = 1;
-        m_speedModifiers[idx] = 0.0f;
-      } else if (b > 200 && r < 50 && g < 50) {
-        // Blue = Road / Fast
-        m_data[idx] = 0;
-        m_speedModifiers[idx] = 1.0f;
-      } else if (r > 200 && g < 50 && b < 50) {
-        // Red = Slow
-        m_data[idx] = 0;
-        m_speedModifiers[idx] = 0.5f;
-      } else {
-        // Other (e.g. white/noise) -> Default Walkable
-        m_data[idx] = 0;
-        m_speedModifiers[idx] = 1.0f;
-      }
+      classifyCell(y * m_width + x, r, g, b, goalCells);
     }
   }
 
   SDL_UnlockSurface(maskSurf);
-  SDL_FreeSurface(maskSurf);
-
-  // Recalculate AI
-  calculateFlowField();
-
-  return true;
+  finishBuild(goalCells);
 }
 
 float Map::getSpeedModifier(int x, int y) const {
@@ -134,6 +220,123 @@ float Map::getSpeedModifier(int x, int y) const {
   return 0.0f;
 }
 
+void Map::setDefaultGoal() {
+  // The old centre fortress: cells whose centre is within 5 of the middle
+  float cx = m_width / 2;
+  float cy = m_height / 2;
+  m_goalIds.assign(m_width * m_height, 0);
+  for (int y = std::max(0, (int)cy - 6); y < std::min(m_height, (int)cy + 6);
+       ++y) {
+    for (int x = std::max(0, (int)cx - 6); x < std::min(m_width, (int)cx + 6);
+         ++x) {
+      float dx = x + 0.5f - cx;
+      float dy = y + 0.5f - cy;
+      if (dx * dx + dy * dy < 25.0f)
+        m_goalIds[y * m_width + x] = 1;
+    }
+  }
+  m_defaultGoal = true;
+  summarizeGoals(1);
+}
+
+void Map::labelGoals(const std::vector<unsigned char> &marked) {
+  m_goalIds.assign(m_width * m_height, 0);
+  int goalCount = 0;
+  std::vector<int> stack;
+  for (int i = 0; i < m_width * m_height; ++i) {
+    if (!marked[i] || m_goalIds[i])
+      continue;
+    if (goalCount == kMaxGoals) {
+      printf("Map has more than %d goal regions, ignoring the rest\n",
+             kMaxGoals);
+      break;
+    }
+    goalCount++;
+    m_goalIds[i] = goalCount;
+    stack.push_back(i);
+    while (!stack.empty()) {
+      int c = stack.back();
+      stack.pop_back();
+      int x = c % m_width;
+      int y = c / m_width;
+      const int neighbours[4] = {x > 0 ? c - 1 : -1,
+                                 x + 1 < m_width ? c + 1 : -1,
+                                 y > 0 ? c - m_width : -1,
+                                 y + 1 < m_height ? c + m_width : -1};
+      for (int n : neighbours) {
+        if (n >= 0 && marked[n] && !m_goalIds[n]) {
+          m_goalIds[n] = goalCount;
+          stack.push_back(n);
+        }
+      }
+    }
+  }
+
+  if (goalCount == 0) {
+    setDefaultGoal();
+    return;
+  }
+  m_defaultGoal = false;
+  summarizeGoals(goalCount);
+}
+
+void Map::summarizeGoals(int goalCount) {
+  m_goals.assign(goalCount, {0.0f, 0.0f, 0});
+  for (int y = 0; y < m_height; ++y) {
+    for (int x = 0; x < m_width; ++x) {
+      int id = m_goalIds[y * m_width + x];
+      if (id) {
+        Goal &goal = m_goals[id - 1];
+        goal.x += x + 0.5f;
+        goal.y += y + 0.5f;
+        goal.cells++;
+      }
+    }
+  }
+  for (Goal &goal : m_goals) {
+    if (goal.cells > 0) {
+      goal.x /= goal.cells;
+      goal.y /= goal.cells;
+    }
+  }
+}
+
+int Map::addGoal(float x, float y, float radius) {
+  if (m_defaultGoal) {
+    m_goalIds.assign(m_width * m_height, 0);
+    m_goals.clear();
+  } else if ((int)m_goals.size() >= kMaxGoals) {
+    return -1;
+  }
+  int id = m_goals.size() + 1;
+
+  int cells = 0;
+  for (int cy = std::max(0, (int)(y - radius));
+       cy <= std::min(m_height - 1, (int)(y + radius)); ++cy) {
+    for (int cx = std::max(0, (int)(x - radius));
+         cx <= std::min(m_width - 1, (int)(x + radius)); ++cx) {
+      float dx = cx + 0.5f - x;
+      float dy = cy + 0.5f - y;
+      if (dx * dx + dy * dy < radius * radius) {
+        m_goalIds[cy * m_width + cx] = id;
+        cells++;
+      }
+    }
+  }
+  if (cells == 0) {
+    if (m_defaultGoal)
+      setDefaultGoal();
+    return -1;
+  }
+
+  // Cells taken over from an earlier goal may have emptied it; it keeps its
+  // index with no cells
+  m_defaultGoal = false;
+  summarizeGoals(id);
+  calculateFlowField();
+  return id - 1;
+}
+
 void Map::generate() {
   // Simple cellular automata or random noise for "apocalyptic city"
   // Let's start with random noise + smoothing (cellular automata steps)
@@ -195,85 +398,384 @@ void Map::generate() {
     }
   }
   calculateFlowField();
+  calculateDistanceField();
 }
 
 void Map::calculateFlowField() {
-  std::vector<int> distance(m_width * m_height, -1);
-  std::vector<int> queue;
-
-  int centerX = m_width / 2;
-  int centerY = m_height / 2;
-
-  // Target is the center
-  distance[centerY * m_width + centerX] = 0;
-  queue.push_back(centerY * m_width + centerX);
-
-  // BFS
-  int head = 0;
-  while (head < queue.size()) {
-    int idx = queue[head++];
-    int x = idx % m_width;
-    int y = idx / m_width;
-
-    // Check 4 neighbors
-    int dx[] = {0, 0, -1, 1};
-    int dy[] = {-1, 1, 0, 0};
-
-    for (int k = 0; k < 4; ++k) {
-      int nx = x + dx[k];
-      int ny = y + dy[k];
-      if (nx >= 0 && nx < m_width && ny >= 0 && ny < m_height) {
-        int nidx = ny * m_width + nx;
-        if (m_data[nidx] == 0 && distance[nidx] == -1) {
-          distance[nidx] = distance[idx] + 1;
-          queue.push_back(nidx);
+  // Below this many cells thread start-up costs more than the BFS itself
+  const int parallelThreshold = 1 << 18;
+  // Switch to bottom-up once the frontier holds this fraction of open cells
+  const int bottomUpRatio = 16;
+
+  if (m_width <= 0 || m_height <= 0)
+    return;
+
+  double start = Instrumentation::now();
+  m_occupancy.build(m_data, m_width, m_height);
+
+  // Work on a copy padded with a one-cell blocked border, so neighbours are
+  // plain index offsets with no bounds checks and no idx % width.
+  int pw = m_width + 2;
+  int ph = m_height + 2;
+  int cellCount = pw * ph;
+  const int offsets[4] = {-pw, pw, -1, 1};
+
+  int threadCount =
+      (m_width * m_height >= parallelThreshold) ? parallelThreadCount() : 1;
+
+  std::vector<unsigned char> open(cellCount, 0);
+  std::vector<std::atomic<int>> distance(cellCount);
+  // The goal cell each cell's path starts from. Written by the one thread
+  // that claims the cell and read only on later levels, after the barrier.
+  std::vector<int> source(cellCount, -1);
+  std::vector<int> openCounts(threadCount, 0);
+
+  runParallel(threadCount, [&](int t) {
+    int rowBegin = ph * t / threadCount;
+    int rowEnd = ph * (t + 1) / threadCount;
+    for (int py = rowBegin; py < rowEnd; ++py) {
+      for (int px = 0; px < pw; ++px) {
+        int idx = py * pw + px;
+        distance[idx].store(-1, std::memory_order_relaxed);
+        if (px > 0 && px <= m_width && py > 0 && py <= m_height &&
+            m_data[(py - 1) * m_width + (px - 1)] == 0) {
+          open[idx] = 1;
+          openCounts[t]++;
         }
       }
     }
-  }
+  });
+
+  int openCount = 0;
+  for (int c : openCounts)
+    openCount += c;
 
-  // Compute Vectors from distance map
+  // Every goal cell is a source, so each cell ends up heading for the
+  // nearest goal
+  std::vector<int> frontier;
+  int unvisited = openCount;
   for (int y = 0; y < m_height; ++y) {
     for (int x = 0; x < m_width; ++x) {
-      int idx = y * m_width + x;
-      if (m_data[idx] == 1)
-        continue; // Wall
-      if (distance[idx] == -1)
-        continue; // Unreachable
-
-      float vecX = 0;
-      float vecY = 0;
-
-      int minVal = distance[idx];
-
-      // Check neighbors to find gradient
-      int dx[] = {0, 0, -1, 1};
-      int dy[] = {-1, 1, 0, 0};
-
-      for (int k = 0; k < 4; k++) {
-        int nx = x + dx[k];
-        int ny = y + dy[k];
-        if (nx >= 0 && nx < m_width && ny >= 0 && ny < m_height) {
-          int nidx = ny * m_width + nx;
-          if (distance[nidx] != -1 && distance[nidx] < minVal) {
+      int id = m_goalIds[y * m_width + x];
+      if (!id)
+        continue;
+      int idx = (y + 1) * pw + (x + 1);
+      distance[idx].store(0, std::memory_order_relaxed);
+      source[idx] = idx;
+      frontier.push_back(idx);
+      unvisited -= open[idx];
+    }
+  }
+
+  // Level-synchronous BFS. Top-down levels split the frontier across
+  // threads and claim cells with a CAS; bottom-up levels split the rows and
+  // let each unvisited cell look for a parent on the current level, which
+  // needs no CAS since every cell has one owner. Each thread collects its
+  // share of the next frontier locally; thread 0 merges between levels.
+  std::vector<std::vector<int>> next(threadCount);
+  int level = 0;
+  bool bottomUp = false;
+  bool done = frontier.empty();
+  Barrier barrier(threadCount);
+
+  runParallel(threadCount, [&](int t) {
+    while (!done) {
+      next[t].clear();
+      if (!bottomUp) {
+        int begin = (long long)frontier.size() * t / threadCount;
+        int end = (long long)frontier.size() * (t + 1) / threadCount;
+        for (int f = begin; f < end; ++f) {
+          int idx = frontier[f];
+          for (int off : offsets) {
+            int nidx = idx + off;
+            if (!open[nidx] ||
+                distance[nidx].load(std::memory_order_relaxed) != -1)
+              continue;
+            int expected = -1;
+            if (distance[nidx].compare_exchange_strong(
+                    expected, level + 1, std::memory_order_relaxed)) {
+              source[nidx] = source[idx];
+              next[t].push_back(nidx);
+            }
+          }
+        }
+      } else {
+        int rowBegin = 1 + m_height * t / threadCount;
+        int rowEnd = 1 + m_height * (t + 1) / threadCount;
+        for (int py = rowBegin; py < rowEnd; ++py) {
+          for (int idx = py * pw + 1; idx <= py * pw + m_width; ++idx) {
+            if (!open[idx] ||
+                distance[idx].load(std::memory_order_relaxed) != -1)
+              continue;
+            for (int off : offsets) {
+              if (distance[idx + off].load(std::memory_order_relaxed) ==
+                  level) {
+                distance[idx].store(level + 1, std::memory_order_relaxed);
+                source[idx] = source[idx + off];
+                next[t].push_back(idx);
+                break;
+              }
+            }
+          }
+        }
+      }
+
+      barrier.wait();
+      if (t == 0) {
+        frontier.clear();
+        for (const auto &local : next) {
+          frontier.insert(frontier.end(), local.begin(), local.end());
+        }
+        unvisited -= frontier.size();
+        level++;
+        bottomUp = (long long)frontier.size() * bottomUpRatio > openCount &&
+                   unvisited > 0;
+        done = frontier.empty();
+      }
+      barrier.wait();
+    }
+  });
+
+  // Compute Vectors from distance map: one parallel sweep over rows. Each
+  // cell points towards its 4-neighbours that are closer to a goal, except
+  // where the goal cell its path starts from is in plain sight: there the
+  // BFS gradient only knows the four axis directions and zig-zags, so head
+  // straight for it. A clear sight line passes through a monotone chain of
+  // open cells, so only cells whose BFS distance equals their Manhattan
+  // distance to that goal cell can see it; the rest need no ray. Rays are
+  // cast from the goal out, where the walls around it stop the blocked ones
+  // within a few steps.
+  m_goalDistance.resize(m_width * m_height);
+  runParallel(threadCount, [&](int t) {
+    int rowBegin = m_height * t / threadCount;
+    int rowEnd = m_height * (t + 1) / threadCount;
+    const int dx[] = {0, 0, -1, 1};
+    const int dy[] = {-1, 1, 0, 0};
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+      const std::atomic<int> *row = &distance[(y + 1) * pw + 1];
+      Vector2 *out = &m_flowField[y * m_width];
+      const int *rowSource = &source[(y + 1) * pw + 1];
+      for (int x = 0; x < m_width; ++x) {
+        int minVal = row[x].load(std::memory_order_relaxed);
+        m_goalDistance[y * m_width + x] = minVal;
+        // Walls and unreachable cells have no distance
+        if (minVal == -1 || m_data[y * m_width + x] == 1) {
+          out[x] = {0.0f, 0.0f};
+          continue;
+        }
+
+        int gx = rowSource[x] % pw - 1;
+        int gy = rowSource[x] / pw - 1;
+        float goalX = gx + 0.5f;
+        float goalY = gy + 0.5f;
+        int manhattan = std::abs(x - gx) + std::abs(y - gy);
+        if (minVal > 0 && minVal == manhattan &&
+            m_occupancy.lineOfSight(goalX, goalY, x + 0.5f, y + 0.5f)) {
+          float toGoalX = goalX - (x + 0.5f);
+          float toGoalY = goalY - (y + 0.5f);
+          float len = std::sqrt(toGoalX * toGoalX + toGoalY * toGoalY);
+          out[x] = {toGoalX / len, toGoalY / len};
+          continue;
+        }
+
+        float vecX = 0;
+        float vecY = 0;
+        for (int k = 0; k < 4; k++) {
+          int d = row[x + offsets[k]].load(std::memory_order_relaxed);
+          if (d != -1 && d < minVal) {
             // Point towards smaller distance
             vecX += dx[k];
             vecY += dy[k];
           }
         }
+
+        // Normalize
+        float len = std::sqrt(vecX * vecX + vecY * vecY);
+        if (len > 0) {
+          out[x] = {vecX / len, vecY / len};
+        } else {
+          out[x] = {0.0f, 0.0f}; // If no gradient, stay put
+        }
       }
+    }
+  });
+
+  m_flowFieldBuildTime = Instrumentation::now() - start;
+}
+
+// 1D squared Euclidean distance transform (Felzenszwalb & Huttenlocher).
+// f holds 0 at feature cells and a large value elsewhere; d receives the
+// squared distance to the nearest feature. v and z are scratch of size n and
+// n + 1.
+static void distanceTransform1D(const float *f, float *d, int n, int *v,
+                                float *z) {
+  const float inf = 1e20f;
+  int k = 0;
+  v[0] = 0;
+  z[0] = -inf;
+  z[1] = inf;
+  for (int q = 1; q < n; ++q) {
+    float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) /
+              (2.0f * (q - v[k]));
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) /
+          (2.0f * (q - v[k]));
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = inf;
+  }
+
+  k = 0;
+  for (int q = 0; q < n; ++q) {
+    while (z[k + 1] < q)
+      k++;
+    float dq = (float)(q - v[k]);
+    d[q] = dq * dq + f[v[k]];
+  }
+}
+
+// Squared distance from every cell centre to the nearest cell whose value in
+// data equals target. Separable: columns first, then rows.
+static std::vector<float> squaredDistanceTo(const std::vector<unsigned char> &data,
+                                            unsigned char target, int width,
+                                            int height) {
+  const float inf = 1e20f;
+  std::vector<float> grid(width * height);
+  for (int i = 0; i < width * height; ++i) {
+    grid[i] = (data[i] == target) ? 0.0f : inf;
+  }
+
+  int n = std::max(width, height);
+  std::vector<float> f(n), d(n), z(n + 1);
+  std::vector<int> v(n);
+
+  for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < height; ++y)
+      f[y] = grid[y * width + x];
+    distanceTransform1D(f.data(), d.data(), height, v.data(), z.data());
+    for (int y = 0; y < height; ++y)
+      grid[y * width + x] = d[y];
+  }
 
-      // Normalize
-      float len = std::sqrt(vecX * vecX + vecY * vecY);
+  for (int y = 0; y < height; ++y) {
+    float *row = &grid[y * width];
+    std::copy(row, row + width, f.begin());
+    distanceTransform1D(f.data(), row, width, v.data(), z.data());
+  }
+
+  return grid;
+}
+
+void Map::calculateDistanceField() {
+  int size = m_width * m_height;
+  m_distanceField.assign(size, 0.0f);
+  m_distanceGradient.assign(size, {0.0f, 0.0f});
+  if (size == 0)
+    return;
+
+  // Distance between cell centres is offset by half a cell to get distance to
+  // the wall surface: a free cell touching a wall sits 0.5 from it.
+  std::vector<float> toWall = squaredDistanceTo(m_data, 1, m_width, m_height);
+  std::vector<float> toFree = squaredDistanceTo(m_data, 0, m_width, m_height);
+
+  // Without any walls the field is effectively infinite; cap it to the map
+  // diagonal so sampling stays finite.
+  float maxDist = std::sqrt((float)m_width * m_width +
+                            (float)m_height * m_height);
+
+  for (int i = 0; i < size; ++i) {
+    if (m_data[i] == 1) {
+      m_distanceField[i] = -(std::min(std::sqrt(toFree[i]), maxDist) - 0.5f);
+    } else {
+      m_distanceField[i] = std::min(std::sqrt(toWall[i]), maxDist) - 0.5f;
+    }
+  }
+
+  // Central differences (one-sided at the borders)
+  for (int y = 0; y < m_height; ++y) {
+    for (int x = 0; x < m_width; ++x) {
+      int x0 = std::max(x - 1, 0);
+      int x1 = std::min(x + 1, m_width - 1);
+      int y0 = std::max(y - 1, 0);
+      int y1 = std::min(y + 1, m_height - 1);
+
+      float gx = 0.0f;
+      float gy = 0.0f;
+      if (x1 > x0)
+        gx = (m_distanceField[y * m_width + x1] -
+              m_distanceField[y * m_width + x0]) /
+             (x1 - x0);
+      if (y1 > y0)
+        gy = (m_distanceField[y1 * m_width + x] -
+              m_distanceField[y0 * m_width + x]) /
+             (y1 - y0);
+
+      float len = std::sqrt(gx * gx + gy * gy);
       if (len > 0) {
-        m_flowField[idx] = {vecX / len, vecY / len};
-      } else {
-        m_flowField[idx] = {0.0f, 0.0f}; // If no gradient, stay put
+        m_distanceGradient[y * m_width + x] = {gx / len, gy / len};
       }
     }
   }
 }
 
+float Map::getDistanceAt(float x, float y) const {
+  if (m_distanceField.empty())
+    return 0.0f;
+
+  // Samples live at cell centres
+  float fx = std::max(0.0f, std::min(x - 0.5f, (float)(m_width - 1)));
+  float fy = std::max(0.0f, std::min(y - 0.5f, (float)(m_height - 1)));
+  int x0 = (int)fx;
+  int y0 = (int)fy;
+  int x1 = std::min(x0 + 1, m_width - 1);
+  int y1 = std::min(y0 + 1, m_height - 1);
+  float tx = fx - x0;
+  float ty = fy - y0;
+
+  float d00 = m_distanceField[y0 * m_width + x0];
+  float d10 = m_distanceField[y0 * m_width + x1];
+  float d01 = m_distanceField[y1 * m_width + x0];
+  float d11 = m_distanceField[y1 * m_width + x1];
+
+  float top = d00 + (d10 - d00) * tx;
+  float bottom = d01 + (d11 - d01) * tx;
+  return top + (bottom - top) * ty;
+}
+
+Map::Vector2 Map::getDistanceGradientAt(float x, float y) const {
+  if (m_distanceGradient.empty())
+    return {0.0f, 0.0f};
+
+  float fx = std::max(0.0f, std::min(x - 0.5f, (float)(m_width - 1)));
+  float fy = std::max(0.0f, std::min(y - 0.5f, (float)(m_height - 1)));
+  int x0 = (int)fx;
+  int y0 = (int)fy;
+  int x1 = std::min(x0 + 1, m_width - 1);
+  int y1 = std::min(y0 + 1, m_height - 1);
+  float tx = fx - x0;
+  float ty = fy - y0;
+
+  const Vector2 &g00 = m_distanceGradient[y0 * m_width + x0];
+  const Vector2 &g10 = m_distanceGradient[y0 * m_width + x1];
+  const Vector2 &g01 = m_distanceGradient[y1 * m_width + x0];
+  const Vector2 &g11 = m_distanceGradient[y1 * m_width + x1];
+
+  float gx = (g00.x * (1 - tx) + g10.x * tx) * (1 - ty) +
+             (g01.x * (1 - tx) + g11.x * tx) * ty;
+  float gy = (g00.y * (1 - tx) + g10.y * tx) * (1 - ty) +
+             (g01.y * (1 - tx) + g11.y * tx) * ty;
+
+  float len = std::sqrt(gx * gx + gy * gy);
+  if (len > 0) {
+    return {gx / len, gy / len};
+  }
+  return {0.0f, 0.0f};
+}
+
 Map::Vector2 Map::getFlowAt(int x, int y) const {
   if (x >= 0 && x < m_width && y >= 0 && y < m_height) {
     return m_flowField[y * m_width + x];
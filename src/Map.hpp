@@ -1,4 +1,5 @@
 #pragma once
+#include "OccupancyPyramid.hpp"
 #include <SDL.h>
 #include <vector>
 
@@ -9,6 +10,23 @@ public:
 
   void generate();
   bool load(const char *bgFile, const char *maskFile);
+  // Same as load() but without creating GL textures, for headless runs and
+  // worker processes that never render.
+  bool loadHeadless(const char *bgFile, const char *maskFile);
+
+  // The two halves of load(), for callers that decode images themselves.
+  // build() classifies an already decoded mask and computes the flow and
+  // distance fields; it touches no GL state and may run on a worker thread.
+  // uploadBackground() creates the background texture and must run on the
+  // thread owning the GL context.
+  void build(int width, int height, SDL_Surface *maskSurf);
+  // Same as build() for a PNG mask file, decoded row by row straight into
+  // the map arrays so the whole image is never in memory: peak use is a few
+  // rows on top of the map data itself. Rows below the map are not even
+  // decoded. Returns false if the file can't be streamed (not a PNG, or
+  // interlaced); build() still takes those once decoded.
+  bool buildStreaming(int width, int height, const char *maskFile);
+  void uploadBackground(SDL_Surface *bgSurf);
   void render(SDL_Renderer *renderer); // Using SDL_Renderer for simplicity
                                        // initially, or OpenGL?
   // GAME.md said OpenGL, so maybe we should stick to OpenGL rendering or use
@@ -46,6 +64,37 @@ public:
   };
   const std::vector<Vector2> &getFlowField() const { return m_flowField; }
   Vector2 getFlowAt(int x, int y) const;
+  // Goal regions, where zombies sink. The mask marks them in pure green,
+  // one goal per connected patch; a map without any gets a disc at its
+  // centre. The flow field leads to whichever goal is nearest.
+  struct Goal {
+    float x, y; // Centroid
+    int cells;
+  };
+  static const int kMaxGoals = 255;
+  int getGoalCount() const { return m_goals.size(); }
+  const Goal &getGoal(int goal) const { return m_goals[goal]; }
+  // Goal index + 1 per cell, 0 outside goals
+  const std::vector<unsigned char> &getGoalIds() const { return m_goalIds; }
+  // Path length in cells to the nearest goal, -1 where none is reachable
+  const std::vector<int> &getGoalDistances() const { return m_goalDistance; }
+  // Makes every cell within `radius` of (x, y) a new goal and rebuilds the
+  // flow field. The first call replaces the default centre goal. Returns
+  // the goal's index, or -1 if no cell was in range or there are already
+  // kMaxGoals. Simulations read goals every tick, so add them before
+  // handing the map over.
+  int addGoal(float x, float y, float radius);
+
+  // Walls at 1, 8 and 64 cells per bit, for line-of-sight tests
+  const OccupancyPyramid &getOccupancy() const { return m_occupancy; }
+  // Wall-clock time of the last flow field build, in ms
+  double getFlowFieldBuildTime() const { return m_flowFieldBuildTime; }
+
+  // Signed distance to the nearest wall surface in cells (negative inside
+  // walls), bilinearly sampled at a world position. The gradient points away
+  // from walls and is unit length where defined.
+  float getDistanceAt(float x, float y) const;
+  Vector2 getDistanceGradientAt(float x, float y) const;
 
 private:
   int m_width;
@@ -54,8 +103,29 @@ private:
   std::vector<float>
       m_speedModifiers; // 1.0 = normal, 0.5 = slow, 0.0 = blocked
   std::vector<Vector2> m_flowField;
+  double m_flowFieldBuildTime;
+  OccupancyPyramid m_occupancy;
+  std::vector<unsigned char> m_goalIds;
+  std::vector<Goal> m_goals;
+  bool m_defaultGoal; // m_goals only holds the fallback centre disc
+  std::vector<int> m_goalDistance;
+  std::vector<float> m_distanceField;   // Signed distance to walls, per cell
+  std::vector<Vector2> m_distanceGradient; // Normalised SDF gradient
   unsigned int m_textureID;
   unsigned int m_maskTextureID;
 
+  bool loadMask(const char *maskFile, int width, int height);
+  void resizeCells(int width, int height);
+  void classifyCell(int idx, Uint8 r, Uint8 g, Uint8 b,
+                    std::vector<unsigned char> &goalCells);
+  // Goals and fields, once the cells are classified
+  void finishBuild(const std::vector<unsigned char> &goalCells);
   void calculateFlowField();
+  void calculateDistanceField();
+  // Numbers the 4-connected patches of marked cells as goals, or sets up
+  // the default goal if there are none
+  void labelGoals(const std::vector<unsigned char> &marked);
+  void setDefaultGoal();
+  // Fills in m_goals from m_goalIds
+  void summarizeGoals(int goalCount);
 };
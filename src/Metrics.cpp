@@ -0,0 +1,207 @@
+#include "Metrics.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const double Metrics::kBuckets[kBucketCount] = {0.5, 1,  2,  4,  8,
+                                                16,  33, 66, 133};
+
+Metrics::Metrics()
+    : m_head(0), m_tail(0), m_dropped(0), m_bucketCounts(), m_tickCount(0),
+      m_tickTimeSum(0.0), m_sunkTotal(0), m_last(), m_running(false),
+      m_listenSocket(-1) {}
+
+Metrics::~Metrics() { stop(); }
+
+void Metrics::record(const TickSample &sample) {
+  uint32_t head = m_head.load(std::memory_order_relaxed);
+  if (head - m_tail.load(std::memory_order_acquire) >= kRingSize) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  m_ring[head % kRingSize] = sample;
+  m_head.store(head + 1, std::memory_order_release);
+}
+
+void Metrics::drain() {
+  uint32_t tail = m_tail.load(std::memory_order_relaxed);
+  uint32_t head = m_head.load(std::memory_order_acquire);
+  for (; tail != head; ++tail) {
+    const TickSample &sample = m_ring[tail % kRingSize];
+    for (int b = 0; b < kBucketCount; ++b) {
+      if (sample.tickTime <= kBuckets[b])
+        m_bucketCounts[b]++;
+    }
+    m_tickCount++;
+    m_tickTimeSum += sample.tickTime;
+    m_sunkTotal += sample.sunk;
+    m_last = sample;
+  }
+  m_tail.store(tail, std::memory_order_release);
+}
+
+std::string Metrics::format() const {
+  std::string out;
+  char line[256];
+  auto append = [&](const char *fmt, auto... args) {
+    snprintf(line, sizeof(line), fmt, args...);
+    out += line;
+  };
+
+  // Prometheus wants base units, so times go out in seconds
+  append("# HELP zombie_tick_seconds Duration of Simulation::update.\n"
+         "# TYPE zombie_tick_seconds histogram\n");
+  for (int b = 0; b < kBucketCount; ++b) {
+    append("zombie_tick_seconds_bucket{le=\"%g\"} %llu\n", kBuckets[b] / 1000,
+           (unsigned long long)m_bucketCounts[b]);
+  }
+  append("zombie_tick_seconds_bucket{le=\"+Inf\"} %llu\n",
+         (unsigned long long)m_tickCount);
+  append("zombie_tick_seconds_sum %.9f\n", m_tickTimeSum / 1000);
+  append("zombie_tick_seconds_count %llu\n", (unsigned long long)m_tickCount);
+
+  append("# HELP zombie_sunk_total Zombies that reached the goal.\n"
+         "# TYPE zombie_sunk_total counter\n"
+         "zombie_sunk_total %llu\n",
+         (unsigned long long)m_sunkTotal);
+
+  append("# HELP zombie_particles Zombies alive.\n"
+         "# TYPE zombie_particles gauge\n"
+         "zombie_particles %d\n",
+         m_last.particleCount);
+
+  double jam = m_last.particleCount > 0
+                   ? (double)m_last.jammedCount / m_last.particleCount
+                   : 0.0;
+  append("# HELP zombie_jam_ratio Fraction of zombies barely moving.\n"
+         "# TYPE zombie_jam_ratio gauge\n"
+         "zombie_jam_ratio %.4f\n",
+         jam);
+
+  append("# HELP zombie_flow_field_build_seconds Last flow field build.\n"
+         "# TYPE zombie_flow_field_build_seconds gauge\n"
+         "zombie_flow_field_build_seconds %.6f\n",
+         m_last.flowFieldTime / 1000);
+
+  append("# HELP zombie_metrics_dropped_total Samples lost to a full ring.\n"
+         "# TYPE zombie_metrics_dropped_total counter\n"
+         "zombie_metrics_dropped_total %llu\n",
+         (unsigned long long)m_dropped.load(std::memory_order_relaxed));
+  return out;
+}
+
+bool Metrics::serve(const char *endpoint) {
+  if (m_running)
+    return true;
+
+  if (endpoint[0] == '/') {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(endpoint) >= sizeof(addr.sun_path)) {
+      printf("Metrics socket path too long: %s\n", endpoint);
+      return false;
+    }
+    strcpy(addr.sun_path, endpoint);
+    m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(endpoint); // Left over from a previous run
+    if (m_listenSocket < 0 ||
+        bind(m_listenSocket, (sockaddr *)&addr, sizeof(addr)) != 0) {
+      printf("Failed to bind metrics socket %s: %s\n", endpoint,
+             strerror(errno));
+      stop();
+      return false;
+    }
+    m_socketPath = endpoint;
+  } else {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(std::atoi(endpoint));
+    m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (m_listenSocket >= 0)
+      setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                 sizeof(reuse));
+    if (m_listenSocket < 0 ||
+        bind(m_listenSocket, (sockaddr *)&addr, sizeof(addr)) != 0) {
+      printf("Failed to bind metrics port %s: %s\n", endpoint,
+             strerror(errno));
+      stop();
+      return false;
+    }
+  }
+
+  if (listen(m_listenSocket, 4) != 0) {
+    printf("Failed to listen for metrics: %s\n", strerror(errno));
+    stop();
+    return false;
+  }
+
+  m_running = true;
+  m_thread = std::thread(&Metrics::run, this);
+  printf("Serving metrics on %s\n", endpoint);
+  return true;
+}
+
+void Metrics::stop() {
+  m_running = false;
+  if (m_thread.joinable())
+    m_thread.join();
+  if (m_listenSocket >= 0)
+    close(m_listenSocket);
+  m_listenSocket = -1;
+  if (!m_socketPath.empty())
+    unlink(m_socketPath.c_str());
+  m_socketPath.clear();
+}
+
+void Metrics::run() {
+  while (m_running) {
+    // Wake up regularly even without scrapes so the ring never fills
+    pollfd pfd = {m_listenSocket, POLLIN, 0};
+    int ready = poll(&pfd, 1, 100);
+    drain();
+    if (ready <= 0)
+      continue;
+
+    int client = accept(m_listenSocket, nullptr, nullptr);
+    if (client < 0)
+      continue;
+
+    // Any request gets the metrics; the request itself is not parsed, but
+    // read so the client doesn't see a reset.
+    pollfd cpfd = {client, POLLIN, 0};
+    char request[1024];
+    if (poll(&cpfd, 1, 100) > 0)
+      read(client, request, sizeof(request));
+
+    std::string body = format();
+    char header[160];
+    int headerLength =
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n\r\n",
+                 body.size());
+    std::string response(header, headerLength);
+    response += body;
+
+    const char *p = response.data();
+    size_t left = response.size();
+    while (left > 0) {
+      ssize_t n = send(client, p, left, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      p += n;
+      left -= n;
+    }
+    close(client);
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// What one Simulation::update() reports
+struct TickSample {
+  float tickTime;      // ms
+  int sunk;            // Zombies that reached the goal this tick
+  int particleCount;
+  int jammedCount;     // Owned zombies moving slower than a crawl
+  float flowFieldTime; // ms, last flow field build
+};
+
+// Crowd health for outside observers, in Prometheus text format.
+//
+// The simulation thread only ever calls record(), which copies a sample into
+// a single-producer/single-consumer ring with two atomic stores and never
+// blocks: when the ring is full the sample is counted as dropped. A server
+// thread drains the ring into histograms and counters and answers scrapes
+// over HTTP, either on a localhost TCP port or on a Unix socket
+// (curl --unix-socket PATH http://localhost/metrics).
+class Metrics {
+public:
+  Metrics();
+  ~Metrics();
+
+  void record(const TickSample &sample);
+
+  // endpoint is a port number, or a socket path starting with '/'
+  bool serve(const char *endpoint);
+  void stop();
+
+private:
+  static const int kRingSize = 1024; // Power of two; ~17 s of ticks at 60 Hz
+  static const int kBucketCount = 9;
+  static const double kBuckets[kBucketCount]; // Upper bounds, ms
+
+  TickSample m_ring[kRingSize];
+  // Producer and consumer indices on separate cache lines
+  alignas(64) std::atomic<uint32_t> m_head; // Next slot to write
+  alignas(64) std::atomic<uint32_t> m_tail; // Next slot to read
+  alignas(64) std::atomic<uint64_t> m_dropped;
+
+  // Aggregates, touched by the server thread only
+  uint64_t m_bucketCounts[kBucketCount];
+  uint64_t m_tickCount;
+  double m_tickTimeSum;
+  uint64_t m_sunkTotal;
+  TickSample m_last;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  int m_listenSocket;
+  std::string m_socketPath;
+
+  void drain();
+  std::string format() const;
+  void run();
+};
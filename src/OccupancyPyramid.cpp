@@ -0,0 +1,143 @@
+#include "OccupancyPyramid.hpp"
+#include <algorithm>
+#include <cmath>
+
+void OccupancyPyramid::build(const std::vector<unsigned char> &data, int width,
+                             int height) {
+  m_width = width;
+  m_height = height;
+
+  int levelWidth = width;
+  int levelHeight = height;
+  for (int level = 0; level < kLevels; ++level) {
+    if (level > 0) {
+      levelWidth = (levelWidth + 7) >> kLevelShift;
+      levelHeight = (levelHeight + 7) >> kLevelShift;
+    }
+    m_stride[level] = (levelWidth + 63) / 64;
+    m_bits[level].assign(m_stride[level] * levelHeight, 0);
+  }
+
+  for (int y = 0; y < height; ++y) {
+    uint64_t *row = &m_bits[0][y * m_stride[0]];
+    for (int x = 0; x < width; ++x) {
+      if (data[y * width + x] != 0)
+        row[x >> 6] |= uint64_t(1) << (x & 63);
+    }
+  }
+
+  // Each coarser bit is the OR of the 8x8 bits below it. Blocks hanging
+  // over the right or bottom edge are set too: cells off the map count as
+  // walls, so such a block can never vouch for all of its cells.
+  for (int level = 1; level < kLevels; ++level) {
+    int blockSize = 1 << (level * kLevelShift);
+    int levelWidth = (width + blockSize - 1) / blockSize;
+    int levelHeight = (height + blockSize - 1) / blockSize;
+    auto set = [&](int x, int y) {
+      m_bits[level][y * m_stride[level] + (x >> 6)] |= uint64_t(1) << (x & 63);
+    };
+    if (width % blockSize != 0) {
+      for (int y = 0; y < levelHeight; ++y)
+        set(levelWidth - 1, y);
+    }
+    if (height % blockSize != 0) {
+      for (int x = 0; x < levelWidth; ++x)
+        set(x, levelHeight - 1);
+    }
+
+    const std::vector<uint64_t> &fine = m_bits[level - 1];
+    int fineStride = m_stride[level - 1];
+    int fineRows = fine.size() / fineStride;
+    for (int fy = 0; fy < fineRows; ++fy) {
+      uint64_t *row = &m_bits[level][(fy >> kLevelShift) * m_stride[level]];
+      for (int w = 0; w < fineStride; ++w) {
+        uint64_t word = fine[fy * fineStride + w];
+        while (word) {
+          int x = (w * 64 + __builtin_ctzll(word)) >> kLevelShift;
+          row[x >> 6] |= uint64_t(1) << (x & 63);
+          word &= word - 1;
+        }
+      }
+    }
+  }
+}
+
+// Floor of a / b for b > 0
+static int64_t floorDiv(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+bool OccupancyPyramid::lineOfSight(float x0, float y0, float x1, float y1,
+                                   int topLevel) const {
+  topLevel = std::max(0, std::min(topLevel, kLevels - 1));
+
+  // One integer DDA for every level: endpoints in fixed point, and where the
+  // segment crosses a cell corner exactly, the x step comes first. A level
+  // only decides how far to jump, never which cells the walk lands in, so
+  // all levels give the same answer.
+  const int64_t one = kSubCell;
+  int64_t sx = (int64_t)std::lround(x0 * kSubCell);
+  int64_t sy = (int64_t)std::lround(y0 * kSubCell);
+  int64_t dx = (int64_t)std::lround(x1 * kSubCell) - sx;
+  int64_t dy = (int64_t)std::lround(y1 * kSubCell) - sy;
+  int64_t adx = std::abs(dx);
+  int64_t ady = std::abs(dy);
+  int cx = (int)floorDiv(sx, one);
+  int cy = (int)floorDiv(sy, one);
+
+  while (true) {
+    if (isBlocked(cx, cy))
+      return false;
+
+    // Coarsest clear block around the current cell
+    int shift = 0;
+    for (int level = topLevel; level > 0; --level) {
+      int s = level * kLevelShift;
+      if (!bit(level, cx >> s, cy >> s)) {
+        shift = s;
+        break;
+      }
+    }
+    int size = 1 << shift;
+    int bx = (cx >> shift) << shift;
+    int by = (cy >> shift) << shift;
+
+    // Distance along each axis to the block's exit line; the crossing
+    // happens at time dist / |d|. Compared by cross-multiplying, and a
+    // time past 1 means the segment ends first.
+    int64_t distX = dx > 0 ? (int64_t)(bx + size) * one - sx
+                    : dx < 0 ? sx - (int64_t)bx * one
+                             : 0;
+    int64_t distY = dy > 0 ? (int64_t)(by + size) * one - sy
+                    : dy < 0 ? sy - (int64_t)by * one
+                             : 0;
+    bool endsX = dx == 0 || distX > adx;
+    bool endsY = dy == 0 || distY > ady;
+    if (endsX && endsY)
+      return true; // The rest of the segment is inside this clear block
+    bool exitX = !endsX && (endsY || distX * ady <= distY * adx);
+
+    if (exitX) {
+      cx = dx > 0 ? bx + size : bx - 1;
+      // Cell of y just before the crossing: y lines crossed at the same
+      // instant come after the x step. Never behind the current cell, which
+      // "just before" would be for a crossing at the very start.
+      if (dy != 0) {
+        int64_t num = sy * adx + dy * distX; // y at the crossing, times |dx|
+        int64_t den = one * adx;
+        cy = dy > 0 ? std::max(cy, (int)(floorDiv(num + den - 1, den) - 1))
+                    : std::min(cy, (int)floorDiv(num, den));
+      }
+    } else {
+      cy = dy > 0 ? by + size : by - 1;
+      // Cell of x just before the crossing: an x line crossed at the same
+      // instant was stepped first
+      if (dx != 0) {
+        int64_t num = sx * ady + dx * distY;
+        int64_t den = one * ady;
+        cx = dx > 0 ? std::max(cx, (int)floorDiv(num, den))
+                    : std::min(cx, (int)(floorDiv(num + den - 1, den) - 1));
+      }
+    }
+  }
+}
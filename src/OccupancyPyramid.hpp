@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Wall occupancy as a stack of bitmaps: level 0 has one bit per map cell,
+// level 1 one bit per 8x8 cells, level 2 one per 64x64. A bit is set when
+// any wall lies in its block, so a clear bit vouches for a whole block.
+//
+// lineOfSight() walks the segment through the coarsest clear block around
+// each point and jumps straight to where the segment leaves it, dropping to
+// finer levels only next to walls. Across open ground that is a handful of
+// steps instead of one per cell.
+class OccupancyPyramid {
+public:
+  static const int kLevels = 3;
+  static const int kLevelShift = 3; // Each level is 8x8 of the one below
+  static const int kSubCell = 256;  // Fixed-point steps per cell for rays
+
+  OccupancyPyramid() : m_width(0), m_height(0) {}
+
+  // data is row-major, 0 = open
+  void build(const std::vector<unsigned char> &data, int width, int height);
+
+  bool isBlocked(int x, int y) const {
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+      return true;
+    return bit(0, x, y);
+  }
+
+  // True if the segment between two world positions crosses no wall cell.
+  // Cells off the map count as walls. Endpoints are rounded to 1/kSubCell
+  // of a cell; a segment through a cell corner visits the cell across the x
+  // line first. topLevel limits the coarsest level used; 0 gives the plain
+  // cell-by-cell walk, which always agrees.
+  bool lineOfSight(float x0, float y0, float x1, float y1,
+                   int topLevel = kLevels - 1) const;
+
+private:
+  int m_width;
+  int m_height;
+  std::vector<uint64_t> m_bits[kLevels];
+  int m_stride[kLevels]; // Words per row
+
+  bool bit(int level, int x, int y) const {
+    uint64_t word = m_bits[level][y * m_stride[level] + (x >> 6)];
+    return (word >> (x & 63)) & 1;
+  }
+};
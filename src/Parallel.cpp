@@ -0,0 +1,64 @@
+#include "Parallel.hpp"
+
+WorkerPool::WorkerPool(int threadCount)
+    : m_invoke(nullptr), m_pass(nullptr), m_shares(0), m_pending(0),
+      m_generation(0), m_quit(false) {
+  for (int t = 1; t < threadCount; ++t) {
+    m_threads.emplace_back(&WorkerPool::work, this, t);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_start.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::dispatch(int threadCount, void (*invoke)(void *, int),
+                          void *pass) {
+  int shares = std::min(threadCount, getThreadCount());
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_invoke = invoke;
+    m_pass = pass;
+    m_shares = shares;
+    m_pending = shares - 1;
+    m_generation++;
+  }
+  m_start.notify_all();
+  invoke(pass, 0);
+  for (int t = shares; t < threadCount; ++t) {
+    invoke(pass, t);
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [&] { return m_pending == 0; });
+}
+
+void WorkerPool::work(int share) {
+  // A worker can sleep through passes that don't need it, but a pass that
+  // does can't finish without it, so it never misses one of those.
+  int seen = 0;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_start.wait(lock, [&] { return m_quit || m_generation != seen; });
+    if (m_quit)
+      return;
+    seen = m_generation;
+    if (share >= m_shares)
+      continue;
+
+    void (*invoke)(void *, int) = m_invoke;
+    void *pass = m_pass;
+    lock.unlock();
+    invoke(pass, share);
+    lock.lock();
+    if (--m_pending == 0)
+      m_done.notify_one();
+  }
+}
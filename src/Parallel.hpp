@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker count for data-parallel passes, capped so small machines and
+// oversubscribed hosts are not flooded with threads.
+inline int parallelThreadCount(int maxThreads = 8) {
+  int hw = (int)std::thread::hardware_concurrency();
+  return std::max(1, std::min(maxThreads, hw));
+}
+
+// Runs fn(t) for t in [0, threadCount), the first one on the calling thread.
+// Starts threads for the call, which suits one-off passes such as building
+// the map's fields; passes that run every tick go through a WorkerPool.
+template <typename Fn> void runParallel(int threadCount, Fn fn) {
+  std::vector<std::thread> threads;
+  for (int t = 1; t < threadCount; ++t) {
+    threads.emplace_back(fn, t);
+  }
+  fn(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+// Threads kept for passes that run every tick, where starting threads per
+// call would cost more than small passes save and touch the heap each time.
+// run() has runParallel()'s contract: all shares run at once, the first on
+// the caller, so they may meet at a Barrier. Not for nested or concurrent
+// run() calls; each owner (e.g. a Simulation) keeps its own pool.
+class WorkerPool {
+public:
+  // threadCount includes the caller, so a pool of 1 starts no threads
+  explicit WorkerPool(int threadCount);
+  ~WorkerPool();
+
+  int getThreadCount() const { return m_threads.size() + 1; }
+
+  // Runs fn(t) for t in [0, threadCount). Shares beyond getThreadCount()
+  // run on the caller after its own, so only passes with at most that many
+  // shares may use a Barrier.
+  template <typename Fn> void run(int threadCount, Fn fn) {
+    if (threadCount <= 1) {
+      fn(0);
+      return;
+    }
+    // The pass is passed by pointer, so nothing is copied to the heap
+    dispatch(threadCount, [](void *pass, int t) { (*(Fn *)pass)(t); }, &fn);
+  }
+
+private:
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_start;
+  std::condition_variable m_done;
+  void (*m_invoke)(void *, int);
+  void *m_pass;
+  int m_shares;     // Of the current pass
+  int m_pending;    // Worker shares still running
+  int m_generation; // Bumped for every pass
+  bool m_quit;
+
+  void dispatch(int threadCount, void (*invoke)(void *, int), void *pass);
+  void work(int share);
+};
+
+// Reusable barrier for the threads of one runParallel() call, for passes
+// that proceed in lock-step rounds (e.g. BFS levels).
+class Barrier {
+public:
+  explicit Barrier(int count)
+      : m_count(count), m_waiting(0), m_generation(0) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int generation = m_generation;
+    if (++m_waiting == m_count) {
+      m_waiting = 0;
+      m_generation++;
+      m_condition.notify_all();
+    } else {
+      m_condition.wait(lock, [&] { return generation != m_generation; });
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  int m_count;
+  int m_waiting;
+  int m_generation;
+};
@@ -0,0 +1,90 @@
+#include "QualityGovernor.hpp"
+#include "Instrumentation.hpp"
+#include <algorithm>
+
+QualityGovernor::QualityGovernor(double budgetMs)
+    : m_budget(budgetMs), m_level(Full), m_windowSum(0.0), m_windowPeak(0.0),
+      m_windowFrames(0), m_calm(0), m_cooldown(0) {}
+
+void QualityGovernor::setBudget(double budgetMs) {
+  m_budget = budgetMs;
+  m_windowSum = 0.0;
+  m_windowPeak = 0.0;
+  m_windowFrames = 0;
+  m_calm = 0;
+  m_cooldown = 0;
+  if (m_budget > 0)
+    Instrumentation::log("Governor: frame budget %.2f ms", m_budget);
+  else
+    Instrumentation::log("Governor: off");
+}
+
+const char *QualityGovernor::levelName(Level level) {
+  switch (level) {
+  case Full:
+    return "full quality";
+  case Points:
+    return "points";
+  case Density:
+    return "density map";
+  case HalfRateNeighbors:
+    return "half-rate neighbours";
+  case NoJitter:
+    return "no jitter";
+  case SingleSubstep:
+    return "single substep";
+  default:
+    return "?";
+  }
+}
+
+bool QualityGovernor::addFrame(double frameMs, double tickMs) {
+  if (m_budget <= 0) {
+    if (m_level == Full)
+      return false;
+    m_level = Full;
+    return true;
+  }
+
+  double cost = std::max(frameMs, tickMs);
+  m_windowSum += cost;
+  m_windowPeak = std::max(m_windowPeak, cost);
+  if (++m_windowFrames < kWindowFrames)
+    return false;
+
+  double mean = m_windowSum / m_windowFrames;
+  double peak = m_windowPeak;
+  m_windowSum = 0.0;
+  m_windowPeak = 0.0;
+  m_windowFrames = 0;
+
+  if (m_cooldown > 0) {
+    m_cooldown--;
+    return false;
+  }
+
+  Level from = m_level;
+  if (mean > m_budget) {
+    m_calm = 0;
+    if (m_level + 1 < LevelCount)
+      m_level = (Level)(m_level + 1);
+    else
+      return false; // Nothing left to give up
+  } else if (mean < m_budget * kHeadroom && m_level > Full) {
+    if (++m_calm < kCalmWindows)
+      return false;
+    m_calm = 0;
+    m_level = (Level)(m_level - 1);
+  } else {
+    m_calm = 0;
+    return false;
+  }
+
+  m_cooldown = 1;
+  Instrumentation::log(
+      "Governor: mean %.2f ms (peak %.2f) against %.2f ms budget, %s %d (%s) "
+      "-> %d (%s)",
+      mean, peak, m_budget, m_level > from ? "down" : "up", from,
+      levelName(from), m_level, levelName(m_level));
+  return true;
+}
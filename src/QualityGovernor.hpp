@@ -0,0 +1,52 @@
+#pragma once
+
+// Keeps frames inside a time budget by giving up quality one rung at a time
+// and taking it back once there is headroom again.
+//
+// Each frame reports its render work and the latest simulation tick; the
+// larger of the two is what has to fit the budget, as either one running
+// over makes the game stutter. Costs are averaged over short windows. A
+// window over budget steps one rung down the ladder; only several windows
+// in a row well under budget step one rung back up, and after every step
+// one window is skipped so the change can show in the timings. The gap
+// between the two thresholds keeps the level from flapping.
+//
+// Every decision goes to the instrumentation log.
+class QualityGovernor {
+public:
+  // Rungs from full quality down; each one keeps the cuts of those above
+  enum Level {
+    Full,
+    Points,            // Points instead of sprites
+    Density,           // Density map instead of individual zombies
+    HalfRateNeighbors, // Separation neighbours every second tick
+    NoJitter,          // No random steering noise
+    SingleSubstep,     // One wall-collision substep per tick
+    LevelCount
+  };
+
+  // A budget of 0 turns the governor off; the level then stays Full
+  explicit QualityGovernor(double budgetMs = 1000.0 / 60.0);
+
+  void setBudget(double budgetMs);
+  double getBudget() const { return m_budget; }
+
+  // Returns true when this frame changed the level
+  bool addFrame(double frameMs, double tickMs);
+  Level getLevel() const { return m_level; }
+
+  static const char *levelName(Level level);
+
+private:
+  static const int kWindowFrames = 30;
+  static const int kCalmWindows = 4; // ~2 s at 60 fps before stepping up
+  static constexpr double kHeadroom = 0.6; // Step up below this share
+
+  double m_budget;
+  Level m_level;
+  double m_windowSum;
+  double m_windowPeak;
+  int m_windowFrames;
+  int m_calm;     // Consecutive windows under the headroom threshold
+  int m_cooldown; // Windows to skip after a step
+};
@@ -1,34 +1,94 @@
 #include "Simulation.hpp"
+#include "CongestionField.hpp"
+#include "Instrumentation.hpp"
+#include "Metrics.hpp"
+#include "Parallel.hpp"
 #include <SDL_opengl.h>
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <limits>
 
-Simulation::Simulation(Map *map)
-    : m_map(map), m_score(0), m_textureID(0), m_zombieSize(1.0f) {}
+// Spawning stops once this many zombies are alive (across all domains)
+static const int kMaxParticles = 10000;
+
+Simulation::Simulation(const Map *map)
+    : m_map(map), m_score(0), m_goalScores(Map::kMaxGoals, 0),
+      m_random(std::rand()), m_spawnRandom(std::rand()), m_textureID(0),
+      m_zombieSize(1.0f), m_renderLod(RenderLod::Sprites),
+      m_renderView{0, 0, 0, 0}, m_renderViewSet(false),
+      m_updateView{0, 0, 0, 0}, m_updateLod(false),
+      m_neighborInterval(1), m_jitter(true),
+      m_maxSubsteps(0), m_congestionInterval(0), m_heatmap(false),
+      m_domainBegin(0), m_domainEnd(-1), m_remoteParticleCount(0),
+      m_reorderInterval(32), m_tickCount(0), m_reorderDue(false),
+      m_neighborStrategy(NeighborStrategy::Grid), m_verletSkin(3.0f),
+      m_verletCutoff(0.0f), m_verletAge(0), m_verletRebuilds(0),
+      m_verletDirty(true), m_gridWidth(0), m_gridHeight(0), m_cellSize(4),
+      m_gridReach(1),
+      m_gridCurrent(false), m_threadCount(0), m_metrics(nullptr) {
+  std::fill(m_blockStart, m_blockStart + kZombieTypeCount + 1, 0);
+  setTypeMix(0.0f, 0.0f, 0.0f);
+}
 
 Simulation::~Simulation() {}
 
+int Simulation::getCongestionBuildCount() const {
+  return m_congestion ? m_congestion->getBuildCount() : 0;
+}
+
 void Simulation::init(int particleCount) {
   m_particles.clear();
-  m_particles.reserve(particleCount);
+  m_ids.clear();
+  m_idToIndex.clear();
+  m_freeIds.clear();
+  m_pendingSpawns.clear();
+  std::fill(m_blockStart, m_blockStart + kZombieTypeCount + 1, 0);
+
+  // Room for the spawn cap up front, so spawning never regrows storage
+  int capacity = std::max(particleCount, kMaxParticles);
+  m_particles.reserve(capacity);
+  m_ids.reserve(capacity);
+  m_idToIndex.reserve(capacity);
+  m_freeIds.reserve(capacity);
+  m_sunk.reserve(capacity);
+  if (m_neighborStrategy == NeighborStrategy::Verlet) {
+    // Dense crowds stay well under this many list entries per zombie
+    m_verletOffsets.reserve(capacity + 1);
+    m_verletNeighbors.reserve(capacity * 16);
+    m_verletRowOfId.reserve(capacity);
+    m_verletOrigin.reserve(capacity);
+  } else if (m_neighborStrategy == NeighborStrategy::CellPairs) {
+    m_separation.reserve(capacity);
+  }
+  m_verletDirty = true;
+  int threadCount = m_threadCount > 0 ? m_threadCount : parallelThreadCount();
+  if (!m_pool || m_pool->getThreadCount() != threadCount)
+    m_pool.reset(new WorkerPool(threadCount));
 
   int w = m_map->getWidth();
   int h = m_map->getHeight();
   const auto &data = m_map->getData();
+  int rowBegin = m_domainBegin;
+  int rowEnd = m_domainEnd < 0 ? h : m_domainEnd;
 
   // Grid Init
-  m_cellSize = 4; // Slightly larger than max zombie size (3.5)
+  // Covers a walker at the largest zombie size (3.5); bigger archetypes
+  // widen the neighbour gathers instead (see m_gridReach)
+  m_cellSize = 4;
   m_gridWidth = (w + m_cellSize - 1) / m_cellSize;
   m_gridHeight = (h + m_cellSize - 1) / m_cellSize;
-  m_grid.resize(m_gridWidth * m_gridHeight);
+  m_cellStart.assign(m_gridWidth * m_gridHeight + 1, 0);
 
   for (int i = 0; i < particleCount; ++i) {
     // Find random valid position
     int lx, ly;
     int attempts = 0;
     do {
-      lx = std::rand() % w;
-      ly = std::rand() % h;
+      lx = nextRandom() % w;
+      ly = rowBegin + nextRandom() % (rowEnd - rowBegin);
       attempts++;
     } while (data[ly * w + lx] != 0 && attempts < 100);
 
@@ -38,141 +98,1021 @@ void Simulation::init(int particleCount) {
       p.y = ly + 0.5f;
       p.vx = 0;
       p.vy = 0;
-      p.ax = 0;
-      p.ay = 0;
-      m_particles.push_back(p);
+      pushParticle(p, pickType());
     }
   }
 }
 
-void Simulation::updateGrid() {
-  for (auto &cell : m_grid) {
-    cell.clear();
+void Simulation::setDomain(int rowBegin, int rowEnd) {
+  m_domainBegin = rowBegin;
+  m_domainEnd = rowEnd;
+}
+
+int Simulation::domainRow(float y) const {
+  int row = (int)y;
+  return std::max(0, std::min(row, m_map->getHeight() - 1));
+}
+
+void Simulation::setTypeMix(float runners, float brutes, float crawlers) {
+  float walkers = std::max(0.0f, 1.0f - runners - brutes - crawlers);
+  m_typeMix[(int)ZombieType::Walker] = walkers;
+  m_typeMix[(int)ZombieType::Runner] = walkers + runners;
+  m_typeMix[(int)ZombieType::Brute] = walkers + runners + brutes;
+  m_typeMix[(int)ZombieType::Crawler] = 1.0f;
+}
+
+ZombieType Simulation::pickType() {
+  // An all-walker crowd rolls no dice, so runs stay reproducible as before
+  if (m_typeMix[0] >= 1.0f)
+    return ZombieType::Walker;
+  float r = randomUnit();
+  int t = 0;
+  while (t + 1 < kZombieTypeCount && r >= m_typeMix[t]) {
+    t++;
+  }
+  return (ZombieType)t;
+}
+
+float Simulation::largestTypeSize() const {
+  float size = WalkerTraits::size;
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    if (m_blockStart[t + 1] > m_blockStart[t])
+      size = std::max(size, zombieTypeSize((ZombieType)t));
+  }
+  return size;
+}
+
+ZombieType Simulation::getParticleType(int index) const {
+  int t = 0;
+  while (t + 1 < kZombieTypeCount && index >= m_blockStart[t + 1]) {
+    t++;
+  }
+  return (ZombieType)t;
+}
+
+void Simulation::pushParticle(const Particle &p, ZombieType type) {
+  int id;
+  if (!m_freeIds.empty()) {
+    id = m_freeIds.back();
+    m_freeIds.pop_back();
+  } else {
+    id = m_idToIndex.size();
+    m_idToIndex.push_back(-1);
+  }
+
+  // Open a hole at the end of the type's block: each later block moves its
+  // first particle to its end, so an insert costs at most one move per type.
+  int hole = m_particles.size();
+  m_particles.push_back(p);
+  m_ids.push_back(id);
+  for (int t = kZombieTypeCount - 1; t > (int)type; --t) {
+    int first = m_blockStart[t];
+    if (first != hole) {
+      m_particles[hole] = m_particles[first];
+      m_ids[hole] = m_ids[first];
+      m_idToIndex[m_ids[hole]] = hole;
+    }
+    hole = first;
+    m_blockStart[t]++;
+  }
+  m_blockStart[kZombieTypeCount]++;
+
+  m_particles[hole] = p;
+  m_ids[hole] = id;
+  m_idToIndex[id] = hole;
+  m_gridCurrent = false;
+}
+
+void Simulation::releaseId(int id) {
+  m_idToIndex[id] = -1;
+  m_freeIds.push_back(id);
+}
+
+void Simulation::removeParticleAt(int index) {
+  releaseId(m_ids[index]);
+  int hole = index;
+  for (int t = (int)getParticleType(index); t < kZombieTypeCount; ++t) {
+    int last = m_blockStart[t + 1] - 1;
+    if (last != hole) {
+      m_particles[hole] = m_particles[last];
+      m_ids[hole] = m_ids[last];
+      m_idToIndex[m_ids[hole]] = hole;
+    }
+    hole = last;
+    m_blockStart[t + 1]--;
+  }
+  m_particles.pop_back();
+  m_ids.pop_back();
+  m_gridCurrent = false;
+}
+
+void Simulation::rebuildIdIndex() {
+  for (int i = 0; i < (int)m_ids.size(); ++i) {
+    m_idToIndex[m_ids[i]] = i;
+  }
+}
+
+template <typename Fn> void Simulation::removeParticles(Fn remove) {
+  int kept = 0;
+  int begin = 0;
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    int end = m_blockStart[t + 1];
+    m_blockStart[t] = kept;
+    for (int i = begin; i < end; ++i) {
+      const Particle &p = m_particles[i];
+      if (remove(p, (ZombieType)t)) {
+        releaseId(m_ids[i]);
+      } else {
+        m_ids[kept] = m_ids[i];
+        m_particles[kept++] = p;
+      }
+    }
+    begin = end;
+  }
+  m_blockStart[kZombieTypeCount] = kept;
+
+  if (kept != (int)m_particles.size()) {
+    m_particles.resize(kept);
+    m_ids.resize(kept);
+    rebuildIdIndex();
+    m_gridCurrent = false;
+  }
+}
+
+int Simulation::getParticleIndex(int id) const {
+  if (id < 0 || id >= (int)m_idToIndex.size())
+    return -1;
+  return m_idToIndex[id];
+}
+
+void Simulation::setParticles(const std::vector<Particle> &particles) {
+  m_particles.clear();
+  m_ids.clear();
+  m_idToIndex.clear();
+  m_freeIds.clear();
+  std::fill(m_blockStart, m_blockStart + kZombieTypeCount + 1, 0);
+  addParticles(particles);
+}
+
+void Simulation::addParticles(const std::vector<Particle> &particles) {
+  for (const auto &p : particles) {
+    pushParticle(p, ZombieType::Walker);
+  }
+  if (!particles.empty())
+    m_verletDirty = true;
+}
+
+void Simulation::addParticles(const std::vector<TypedParticle> &particles) {
+  for (const auto &p : particles) {
+    pushParticle(p.particle, p.type);
+  }
+  if (!particles.empty())
+    m_verletDirty = true;
+}
+
+void Simulation::collectHalo(int rows, std::vector<TypedParticle> &up,
+                             std::vector<TypedParticle> &down) const {
+  int rowEnd = m_domainEnd < 0 ? m_map->getHeight() : m_domainEnd;
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    for (int i = m_blockStart[t]; i < m_blockStart[t + 1]; ++i) {
+      const Particle &p = m_particles[i];
+      int row = domainRow(p.y);
+      if (row < m_domainBegin + rows)
+        up.push_back({p, (ZombieType)t});
+      if (row >= rowEnd - rows)
+        down.push_back({p, (ZombieType)t});
+    }
+  }
+}
+
+void Simulation::extractMigrants(std::vector<TypedParticle> &up,
+                                 std::vector<TypedParticle> &down) {
+  int rowEnd = m_domainEnd < 0 ? m_map->getHeight() : m_domainEnd;
+  removeParticles([&](const Particle &p, ZombieType type) {
+    int row = domainRow(p.y);
+    if (row < m_domainBegin) {
+      up.push_back({p, type});
+      return true;
+    }
+    if (row >= rowEnd) {
+      down.push_back({p, type});
+      return true;
+    }
+    return false;
+  });
+}
+
+// Interleave the low 16 bits of x and y into a Morton (Z-order) key
+static uint32_t mortonKey(uint32_t x, uint32_t y) {
+  auto spread = [](uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// LSD radix sort of (key, value) pairs, 8 bits per pass, skipping passes
+// above the highest key bit. Each thread histograms and scatters its own
+// contiguous chunk, so the sort stays stable without atomics. The sorted
+// data may end up in the arena's ping-pong buffers; keys and values are
+// repointed at wherever it lands.
+static void radixSort(uint32_t *&keys, int *&values, int n,
+                      FrameArena &arena, WorkerPool &pool) {
+  const int parallelThreshold = 1 << 15;
+
+  uint32_t maxKey = 0;
+  for (int i = 0; i < n; ++i) {
+    maxKey = std::max(maxKey, keys[i]);
+  }
+
+  int threadCount = 1;
+  if (n >= parallelThreshold) {
+    threadCount = pool.getThreadCount();
+  }
+
+  uint32_t *keysTmp = arena.allocate<uint32_t>(n);
+  int *valuesTmp = arena.allocate<int>(n);
+  auto *counts = arena.allocate<std::array<int, 256>>(threadCount);
+
+  for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += 8) {
+    pool.run(threadCount, [&](int t) {
+      int begin = (long long)n * t / threadCount;
+      int end = (long long)n * (t + 1) / threadCount;
+      counts[t].fill(0);
+      for (int i = begin; i < end; ++i) {
+        counts[t][(keys[i] >> shift) & 0xff]++;
+      }
+    });
+
+    // Exclusive prefix sum in (digit, thread) order
+    int sum = 0;
+    for (int d = 0; d < 256; ++d) {
+      for (int t = 0; t < threadCount; ++t) {
+        int c = counts[t][d];
+        counts[t][d] = sum;
+        sum += c;
+      }
+    }
+
+    pool.run(threadCount, [&](int t) {
+      int begin = (long long)n * t / threadCount;
+      int end = (long long)n * (t + 1) / threadCount;
+      for (int i = begin; i < end; ++i) {
+        int pos = counts[t][(keys[i] >> shift) & 0xff]++;
+        keysTmp[pos] = keys[i];
+        valuesTmp[pos] = values[i];
+      }
+    });
+
+    std::swap(keys, keysTmp);
+    std::swap(values, valuesTmp);
   }
-  for (int i = 0; i < m_particles.size(); ++i) {
+}
+
+void Simulation::reorderParticles() {
+  int n = m_particles.size();
+  uint32_t *keys = m_frameArena.allocate<uint32_t>(n);
+  int *order = m_frameArena.allocate<int>(n);
+
+  for (int i = 0; i < n; ++i) {
     const auto &p = m_particles[i];
+    int gx = std::max(0, std::min((int)p.x / m_cellSize, m_gridWidth - 1));
+    int gy = std::max(0, std::min((int)p.y / m_cellSize, m_gridHeight - 1));
+    keys[i] = mortonKey(gx, gy);
+    order[i] = i;
+  }
+
+  // Sorting each type's block on its own keeps the blocks intact
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    int begin = m_blockStart[t];
+    int count = m_blockStart[t + 1] - begin;
+    uint32_t *blockKeys = keys + begin;
+    int *blockOrder = order + begin;
+    radixSort(blockKeys, blockOrder, count, m_frameArena, *m_pool);
+    if (blockOrder != order + begin)
+      std::copy(blockOrder, blockOrder + count, order + begin);
+  }
+
+  m_reorderScratch.resize(n);
+  int *ids = m_frameArena.allocate<int>(n);
+  for (int i = 0; i < n; ++i) {
+    m_reorderScratch[i] = m_particles[order[i]];
+    ids[i] = m_ids[order[i]];
+  }
+  m_particles.swap(m_reorderScratch);
+  std::copy(ids, ids + n, m_ids.begin());
+  rebuildIdIndex();
+  m_gridCurrent = false;
+}
+
+void Simulation::setNeighborStrategy(NeighborStrategy strategy) {
+  m_neighborStrategy = strategy;
+  m_verletDirty = true;
+  for (const auto &spawn : m_pendingSpawns) {
+    pushParticle(spawn.particle, spawn.type);
+  }
+  m_pendingSpawns.clear();
+}
+
+bool Simulation::verletNeedsRebuild() const {
+  // Lists older than this are refreshed anyway so held-back spawns get in
+  // even when the crowd is jammed and nobody moves.
+  const int maxAge = 16;
+
+  if (m_verletDirty || m_verletAge >= maxAge ||
+      m_zombieSize * largestTypeSize() + m_verletSkin != m_verletCutoff)
+    return true;
+
+  // Two particles approaching each other can close the gap by twice the
+  // largest displacement, so the skin covers moves of up to half its width.
+  float limitSq = 0.25f * m_verletSkin * m_verletSkin;
+  for (int i = 0; i < (int)m_ids.size(); ++i) {
+    const Particle &p = m_particles[i];
+    const Map::Vector2 &origin = m_verletOrigin[m_verletRowOfId[m_ids[i]]];
+    float dx = p.x - origin.x;
+    float dy = p.y - origin.y;
+    if (dx * dx + dy * dy > limitSq)
+      return true;
+  }
+  return false;
+}
+
+void Simulation::buildVerletLists() {
+  int n = m_ids.size();
+  // Wide enough for the largest archetype present
+  m_verletCutoff = m_zombieSize * largestTypeSize() + m_verletSkin;
+  float cutoffSq = m_verletCutoff * m_verletCutoff;
+  int reach = (int)std::ceil(m_verletCutoff / m_cellSize);
+
+  m_verletOffsets.resize(n + 1);
+  m_verletNeighbors.clear();
+  m_verletOrigin.resize(n);
+  // resize() grows geometrically where assign() would reallocate to the
+  // exact size every time the crowd grows by one
+  m_verletRowOfId.resize(m_idToIndex.size());
+  std::fill(m_verletRowOfId.begin(), m_verletRowOfId.end(), -1);
+
+  for (int i = 0; i < n; ++i) {
+    const Particle &p = m_particles[i];
+    m_verletOffsets[i] = m_verletNeighbors.size();
+    m_verletOrigin[i] = {p.x, p.y};
+    m_verletRowOfId[m_ids[i]] = i;
+
     int gx = (int)p.x / m_cellSize;
     int gy = (int)p.y / m_cellSize;
+    for (int ny = std::max(gy - reach, 0);
+         ny <= std::min(gy + reach, m_gridHeight - 1); ++ny) {
+      for (int nx = std::max(gx - reach, 0);
+           nx <= std::min(gx + reach, m_gridWidth - 1); ++nx) {
+        int cell = ny * m_gridWidth + nx;
+        for (int k = m_cellStart[cell]; k < m_cellStart[cell + 1]; ++k) {
+          int j = m_cellParticles[k];
+          if (j == i)
+            continue;
+          float dx = p.x - m_particles[j].x;
+          float dy = p.y - m_particles[j].y;
+          if (dx * dx + dy * dy < cutoffSq)
+            m_verletNeighbors.push_back(m_ids[j]);
+        }
+      }
+    }
+  }
+  m_verletOffsets[n] = m_verletNeighbors.size();
+
+  m_verletAge = 0;
+  m_verletDirty = false;
+  m_verletRebuilds++;
+}
+
+int Simulation::getVerletNeighbors(int pIndex, int *neighbors) const {
+  int row = m_verletRowOfId[m_ids[pIndex]];
+  int count = 0;
+  for (int k = m_verletOffsets[row]; k < m_verletOffsets[row + 1]; ++k) {
+    // Sunk particles drop out here; a recycled ID just adds a harmless
+    // candidate, since separation checks the real distance anyway.
+    int index = m_idToIndex[m_verletNeighbors[k]];
+    if (index >= 0)
+      neighbors[count++] = index;
+  }
+  return count;
+}
+
+// Repulsion of a on b's account; b receives the negation. Linear in the
+// overlap; `weight` is the one the per-particle kernels apply, plus the
+// unweighted term they add on top.
+static inline void separationForce(const Particle &a, const Particle &b,
+                                   float minSep, float weight, float &fx,
+                                   float &fy) {
+  fx = 0;
+  fy = 0;
+  float dx = a.x - b.x;
+  float dy = a.y - b.y;
+  float dSq = dx * dx + dy * dy;
+  if (dSq > 0 && dSq < minSep * minSep) {
+    float d = std::sqrt(dSq);
+    float scale = (minSep - d) / d * weight;
+    fx = dx * scale;
+    fy = dy * scale;
+  }
+}
+
+void Simulation::accumulateCellPairSeparation() {
+  // Half stencil: the cell itself plus the neighbours "after" it within
+  // reach, so every pair of nearby cells is visited exactly once. At reach
+  // 1 that is {1, 0}, {-1, 1}, {0, 1}, {1, 1}.
+  const int parallelThreshold = 1 << 14;
+  int reach = m_gridReach;
+
+  m_separation.resize(m_particles.size());
+  std::fill(m_separation.begin(), m_separation.end(), Map::Vector2{0, 0});
+
+  // A pair of different archetypes keeps apart by their mean size and
+  // pushes with their mean weight. Ghosts follow the owned particles, in
+  // m_ghosts order.
+  int n = m_particles.size();
+  float *radius = m_frameArena.allocate<float>(n);
+  float *weight = m_frameArena.allocate<float>(n);
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    for (int i = m_blockStart[t]; i < m_blockStart[t + 1]; ++i) {
+      radius[i] = m_zombieSize * zombieTypeSize((ZombieType)t) * 0.5f;
+      weight[i] = zombieTypeSeparationWeight((ZombieType)t) * 0.5f;
+    }
+  }
+  for (int i = m_blockStart[kZombieTypeCount]; i < n; ++i) {
+    ZombieType type = m_ghosts[i - m_blockStart[kZombieTypeCount]].type;
+    radius[i] = m_zombieSize * zombieTypeSize(type) * 0.5f;
+    weight[i] = zombieTypeSeparationWeight(type) * 0.5f;
+  }
+
+  // A cell row writes to itself and the `reach` rows below. Splitting rows
+  // into 2T bands of at least that height and running even bands, then odd
+  // bands, keeps concurrent writers at least one band apart.
+  int threadCount = 1;
+  if (m_particles.size() >= parallelThreshold) {
+    threadCount = m_pool->getThreadCount();
+  }
+  int bandCount = std::min(threadCount * 2, m_gridHeight / reach);
+  if (bandCount < 2)
+    threadCount = 1;
+
+  auto processRows = [&](int rowBegin, int rowEnd) {
+    for (int gy = rowBegin; gy < rowEnd; ++gy) {
+      for (int gx = 0; gx < m_gridWidth; ++gx) {
+        int c = gy * m_gridWidth + gx;
+        const int *cell = m_cellParticles.data() + m_cellStart[c];
+        int cellCount = m_cellStart[c + 1] - m_cellStart[c];
+
+        for (int a = 0; a < cellCount; ++a) {
+          int i = cell[a];
+          for (int b = a + 1; b < cellCount; ++b) {
+            int j = cell[b];
+            float fx, fy;
+            separationForce(m_particles[i], m_particles[j],
+                            radius[i] + radius[j], weight[i] + weight[j] + 1.0f,
+                            fx, fy);
+            m_separation[i].x += fx;
+            m_separation[i].y += fy;
+            m_separation[j].x -= fx;
+            m_separation[j].y -= fy;
+          }
+        }
+
+        for (int oy = 0; oy <= reach; ++oy) {
+          for (int ox = oy == 0 ? 1 : -reach; ox <= reach; ++ox) {
+            int nx = gx + ox;
+            int ny = gy + oy;
+            if (nx < 0 || nx >= m_gridWidth || ny >= m_gridHeight)
+              continue;
+            int o = ny * m_gridWidth + nx;
+            for (int a = 0; a < cellCount; ++a) {
+              int i = cell[a];
+              for (int k = m_cellStart[o]; k < m_cellStart[o + 1]; ++k) {
+                int j = m_cellParticles[k];
+                float fx, fy;
+                separationForce(m_particles[i], m_particles[j],
+                                radius[i] + radius[j],
+                                weight[i] + weight[j] + 1.0f, fx, fy);
+                m_separation[i].x += fx;
+                m_separation[i].y += fy;
+                m_separation[j].x -= fx;
+                m_separation[j].y -= fy;
+              }
+            }
+          }
+        }
+      }
+    }
+  };
+
+  if (threadCount == 1) {
+    processRows(0, m_gridHeight);
+    return;
+  }
+
+  for (int phase = 0; phase < 2; ++phase) {
+    m_pool->run(threadCount, [&](int t) {
+      int band = t * 2 + phase;
+      if (band >= bandCount)
+        return;
+      processRows(m_gridHeight * band / bandCount,
+                  m_gridHeight * (band + 1) / bandCount);
+    });
+  }
+}
+
+// Counting sort by cell: count, prefix-sum into m_cellStart, scatter.
+// Within a cell particles stay in storage order.
+void Simulation::updateGrid() {
+  int cellCount = m_gridWidth * m_gridHeight;
+  int n = m_particles.size();
+  int *cellOf = m_frameArena.allocate<int>(n);
+
+  std::fill(m_cellStart.begin(), m_cellStart.end(), 0);
+  for (int i = 0; i < n; ++i) {
+    const auto &p = m_particles[i];
+    int gx = (int)p.x / m_cellSize;
+    int gy = (int)p.y / m_cellSize;
+    cellOf[i] = -1;
     if (gx >= 0 && gx < m_gridWidth && gy >= 0 && gy < m_gridHeight) {
-      m_grid[gy * m_gridWidth + gx].push_back(i);
+      cellOf[i] = gy * m_gridWidth + gx;
+      m_cellStart[cellOf[i] + 1]++;
     }
   }
+  for (int c = 0; c < cellCount; ++c) {
+    m_cellStart[c + 1] += m_cellStart[c];
+  }
+
+  m_cellParticles.resize(m_cellStart[cellCount]);
+  m_gridReach = std::max(
+      1, (int)std::ceil(m_zombieSize * largestTypeSize() / m_cellSize));
+  int *cursor = m_frameArena.allocate<int>(cellCount);
+  std::copy(m_cellStart.begin(), m_cellStart.end() - 1, cursor);
+  for (int i = 0; i < n; ++i) {
+    if (cellOf[i] >= 0)
+      m_cellParticles[cursor[cellOf[i]]++] = i;
+  }
+  m_gridCurrent = true;
 }
 
-void Simulation::getNeighbors(int pIndex, std::vector<int> &neighbors) {
+int Simulation::getNeighbors(int pIndex, int *neighbors) const {
   const auto &p = m_particles[pIndex];
   int gx = (int)p.x / m_cellSize;
   int gy = (int)p.y / m_cellSize;
 
-  for (int y = -1; y <= 1; ++y) {
-    for (int x = -1; x <= 1; ++x) {
-      int nx = gx + x;
-      int ny = gy + y;
-      if (nx >= 0 && nx < m_gridWidth && ny >= 0 && ny < m_gridHeight) {
-        const auto &cell = m_grid[ny * m_gridWidth + nx];
-        neighbors.insert(neighbors.end(), cell.begin(), cell.end());
-      }
+  // The cells of a grid row are adjacent in m_cellParticles, so each row
+  // is one contiguous copy.
+  int x0 = std::max(gx - m_gridReach, 0);
+  int x1 = std::min(gx + m_gridReach, m_gridWidth - 1);
+  int count = 0;
+  if (x0 > x1)
+    return 0;
+  for (int ny = std::max(gy - m_gridReach, 0);
+       ny <= std::min(gy + m_gridReach, m_gridHeight - 1); ++ny) {
+    int begin = m_cellStart[ny * m_gridWidth + x0];
+    int end = m_cellStart[ny * m_gridWidth + x1 + 1];
+    std::copy(m_cellParticles.begin() + begin, m_cellParticles.begin() + end,
+              neighbors + count);
+    count += end - begin;
+  }
+  return count;
+}
+
+bool Simulation::prepareQueries() {
+  if (m_cellStart.empty())
+    return false;
+  if (!m_gridCurrent) {
+    // Between ticks nothing in the tick arena is live
+    m_frameArena.reset();
+    updateGrid();
+  }
+  return true;
+}
+
+int Simulation::queryRadius(float x, float y, float radius, int *out,
+                            int capacity) {
+  return prepareQueries() ? radiusQuery(x, y, radius, out, capacity) : 0;
+}
+
+int Simulation::queryNearest(float x, float y, int k, int *out) {
+  return prepareQueries() ? nearestQuery(x, y, k, out) : 0;
+}
+
+int Simulation::queryBox(float minX, float minY, float maxX, float maxY,
+                         int *out, int capacity) {
+  return prepareQueries() ? boxQuery(minX, minY, maxX, maxY, out, capacity)
+                          : 0;
+}
+
+int Simulation::queryRay(float x, float y, float dx, float dy,
+                         float maxDistance, float *hitDistance) {
+  return prepareQueries() ? rayQuery(x, y, dx, dy, maxDistance, hitDistance)
+                          : -1;
+}
+
+int Simulation::radiusQuery(float x, float y, float radius, int *out,
+                            int capacity) const {
+  int gx0 = std::max(0, (int)std::floor((x - radius) / m_cellSize));
+  int gx1 = std::min(m_gridWidth - 1, (int)std::floor((x + radius) / m_cellSize));
+  int gy0 = std::max(0, (int)std::floor((y - radius) / m_cellSize));
+  int gy1 =
+      std::min(m_gridHeight - 1, (int)std::floor((y + radius) / m_cellSize));
+  float radiusSq = radius * radius;
+
+  // Cells of a grid row are adjacent in m_cellParticles, so each row of the
+  // covering rectangle is one contiguous run
+  int count = 0;
+  for (int gy = gy0; gy <= gy1 && gx0 <= gx1; ++gy) {
+    int begin = m_cellStart[gy * m_gridWidth + gx0];
+    int end = m_cellStart[gy * m_gridWidth + gx1 + 1];
+    for (int k = begin; k < end; ++k) {
+      int i = m_cellParticles[k];
+      float dx = m_particles[i].x - x;
+      float dy = m_particles[i].y - y;
+      if (dx * dx + dy * dy > radiusSq)
+        continue;
+      if (count == capacity)
+        return count;
+      out[count++] = i;
     }
   }
+  return count;
 }
 
-void Simulation::update(float dt) {
-  int w = m_map->getWidth();
-  int h = m_map->getHeight();
-  int centerX = w / 2;
-  int centerY = h / 2;
-  float goalRadiusSq = 25.0f;
+int Simulation::boxQuery(float minX, float minY, float maxX, float maxY,
+                         int *out, int capacity) const {
+  int gx0 = std::max(0, (int)std::floor(minX / m_cellSize));
+  int gx1 = std::min(m_gridWidth - 1, (int)std::floor(maxX / m_cellSize));
+  int gy0 = std::max(0, (int)std::floor(minY / m_cellSize));
+  int gy1 = std::min(m_gridHeight - 1, (int)std::floor(maxY / m_cellSize));
+
+  int count = 0;
+  for (int gy = gy0; gy <= gy1 && gx0 <= gx1; ++gy) {
+    int begin = m_cellStart[gy * m_gridWidth + gx0];
+    int end = m_cellStart[gy * m_gridWidth + gx1 + 1];
+    for (int k = begin; k < end; ++k) {
+      int i = m_cellParticles[k];
+      float px = m_particles[i].x;
+      float py = m_particles[i].y;
+      if (px < minX || px > maxX || py < minY || py > maxY)
+        continue;
+      if (count == capacity)
+        return count;
+      out[count++] = i;
+    }
+  }
+  return count;
+}
 
-  float maxSpeed = 10.0f;
-  float maxForce = 20.0f; // Steering force magnitude
-  float separationDist =
-      m_zombieSize * 1.2f; // Keep distance slightly larger than size
+int Simulation::nearestQuery(float x, float y, int k, int *out) const {
+  if (k <= 0)
+    return 0;
 
-  // Continuous Spawning
-  if (m_particles.size() < 10000) {
-    // ... (Spawning logic can remain same or be refactored, keeping it minimal
-    // for diff size) Re-implementing simplified spawning for this block
-    for (int i = 0; i < 5; ++i) { // 5 per frame
-      int side = std::rand() % 4;
-      int lx, ly;
-      // ... (Edge logic)
-      if (side == 0) {
-        lx = 0;
-        ly = std::rand() % h;
-      } else if (side == 1) {
-        lx = w - 1;
-        ly = std::rand() % h;
-      } else if (side == 2) {
-        lx = std::rand() % w;
-        ly = 0;
-      } else {
-        lx = std::rand() % w;
-        ly = h - 1;
+  // out[0..found) is a max-heap on distance until the end, so the current
+  // k-th nearest is always at the top. Distances are recomputed rather than
+  // stored to keep to the caller's buffer.
+  auto distanceSq = [&](int i) {
+    float dx = m_particles[i].x - x;
+    float dy = m_particles[i].y - y;
+    return dx * dx + dy * dy;
+  };
+  auto closer = [&](int a, int b) { return distanceSq(a) < distanceSq(b); };
+
+  int found = 0;
+  auto visitRow = [&](int gy, int gx0, int gx1) {
+    if (gy < 0 || gy >= m_gridHeight)
+      return;
+    gx0 = std::max(gx0, 0);
+    gx1 = std::min(gx1, m_gridWidth - 1);
+    if (gx0 > gx1)
+      return;
+    int begin = m_cellStart[gy * m_gridWidth + gx0];
+    int end = m_cellStart[gy * m_gridWidth + gx1 + 1];
+    for (int c = begin; c < end; ++c) {
+      int i = m_cellParticles[c];
+      if (found < k) {
+        out[found++] = i;
+        std::push_heap(out, out + found, closer);
+      } else if (distanceSq(i) < distanceSq(out[0])) {
+        std::pop_heap(out, out + k, closer);
+        out[k - 1] = i;
+        std::push_heap(out, out + k, closer);
       }
+    }
+  };
 
-      if (m_map->getData()[ly * w + lx] == 0) {
-        Particle p = {(float)lx + 0.5f, (float)ly + 0.5f, 0, 0, 0, 0};
-        m_particles.push_back(p);
+  // Grow square rings of cells around the query cell until nothing outside
+  // them can beat the current k-th nearest
+  int gx = std::max(0, std::min((int)std::floor(x / m_cellSize), m_gridWidth - 1));
+  int gy =
+      std::max(0, std::min((int)std::floor(y / m_cellSize), m_gridHeight - 1));
+  for (int r = 0;; ++r) {
+    if (r == 0) {
+      visitRow(gy, gx, gx);
+    } else {
+      visitRow(gy - r, gx - r, gx + r);
+      visitRow(gy + r, gx - r, gx + r);
+      for (int ry = gy - r + 1; ry <= gy + r - 1; ++ry) {
+        if (gx - r >= 0)
+          visitRow(ry, gx - r, gx - r);
+        if (gx + r < m_gridWidth)
+          visitRow(ry, gx + r, gx + r);
       }
     }
+
+    bool coversGrid = gx - r <= 0 && gx + r >= m_gridWidth - 1 &&
+                      gy - r <= 0 && gy + r >= m_gridHeight - 1;
+    if (coversGrid)
+      break;
+    if (found == k) {
+      // Distance from the query point to the edge of the rings searched
+      float reach = std::min(std::min(x - (gx - r) * m_cellSize,
+                                      (gx + r + 1) * m_cellSize - x),
+                             std::min(y - (gy - r) * m_cellSize,
+                                      (gy + r + 1) * m_cellSize - y));
+      if (reach > 0 && reach * reach >= distanceSq(out[0]))
+        break;
+    }
+  }
+
+  std::sort_heap(out, out + found, closer);
+  return found;
+}
+
+int Simulation::rayQuery(float x, float y, float dx, float dy,
+                         float maxDistance, float *hitDistance) const {
+  float length = std::sqrt(dx * dx + dy * dy);
+  if (length == 0)
+    return -1;
+  dx /= length;
+  dy /= length;
+
+  // Clip the ray to the grid's extent (slab test)
+  float extentX = (float)m_gridWidth * m_cellSize;
+  float extentY = (float)m_gridHeight * m_cellSize;
+  float tEnter = 0.0f;
+  float tExit = maxDistance;
+  auto clip = [&](float origin, float dir, float extent) {
+    if (dir == 0)
+      return origin >= 0 && origin <= extent;
+    float t0 = (0 - origin) / dir;
+    float t1 = (extent - origin) / dir;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    tEnter = std::max(tEnter, t0);
+    tExit = std::min(tExit, t1);
+    return true;
+  };
+  if (!clip(x, dx, extentX) || !clip(y, dy, extentY) || tEnter > tExit)
+    return -1;
+
+  // Walk the cells the ray passes through (Amanatides & Woo). A body
+  // touching the ray at some point has its centre in that point's cell or
+  // one of its 8 neighbours, as long as body radii stay below the cell
+  // size, so each step checks the 3x3 block around the current cell. Cells
+  // are visited in order of distance, so the walk stops once it is past the
+  // best hit.
+  float px = x + dx * tEnter;
+  float py = y + dy * tEnter;
+  int gx = std::max(0, std::min((int)(px / m_cellSize), m_gridWidth - 1));
+  int gy = std::max(0, std::min((int)(py / m_cellSize), m_gridHeight - 1));
+  int stepX = dx > 0 ? 1 : -1;
+  int stepY = dy > 0 ? 1 : -1;
+  const float never = std::numeric_limits<float>::infinity();
+  float tMaxX =
+      dx != 0 ? ((gx + (dx > 0 ? 1 : 0)) * m_cellSize - x) / dx : never;
+  float tMaxY =
+      dy != 0 ? ((gy + (dy > 0 ? 1 : 0)) * m_cellSize - y) / dy : never;
+  float tDeltaX = dx != 0 ? m_cellSize / std::fabs(dx) : never;
+  float tDeltaY = dy != 0 ? m_cellSize / std::fabs(dy) : never;
+
+  int best = -1;
+  float bestT = maxDistance;
+  float tCell = tEnter;
+  while (tCell <= bestT && tCell <= tExit) {
+    for (int ny = std::max(gy - 1, 0);
+         ny <= std::min(gy + 1, m_gridHeight - 1); ++ny) {
+      int x0 = std::max(gx - 1, 0);
+      int x1 = std::min(gx + 1, m_gridWidth - 1);
+      int begin = m_cellStart[ny * m_gridWidth + x0];
+      int end = m_cellStart[ny * m_gridWidth + x1 + 1];
+      for (int c = begin; c < end; ++c) {
+        int i = m_cellParticles[c];
+        float cx = m_particles[i].x - x;
+        float cy = m_particles[i].y - y;
+        float radius = m_zombieSize * zombieTypeSize(getParticleType(i)) * 0.5f;
+        float along = cx * dx + cy * dy;
+        float off = cx * dy - cy * dx; // Signed distance from the line
+        float offSq = off * off;
+        if (offSq > radius * radius)
+          continue;
+        float t = std::max(0.0f, along - std::sqrt(radius * radius - offSq));
+        if (along + radius < 0 || t > bestT)
+          continue; // Behind the origin, or no closer
+        if (best < 0 || t < bestT) {
+          best = i;
+          bestT = t;
+        }
+      }
+    }
+
+    if (tMaxX < tMaxY) {
+      gx += stepX;
+      tCell = tMaxX;
+      tMaxX += tDeltaX;
+    } else {
+      gy += stepY;
+      tCell = tMaxY;
+      tMaxY += tDeltaY;
+    }
+    if (gx < 0 || gx >= m_gridWidth || gy < 0 || gy >= m_gridHeight)
+      break;
   }
 
-  updateGrid();
-  std::vector<int> neighbors;
-  neighbors.reserve(50);
+  if (best >= 0 && hitDistance)
+    *hitDistance = bestT;
+  return best;
+}
+
+void Simulation::runQuery(SpatialQuery &query) const {
+  switch (query.type) {
+  case SpatialQuery::Radius:
+    query.count =
+        radiusQuery(query.x, query.y, query.radius, query.out, query.capacity);
+    break;
+  case SpatialQuery::Nearest:
+    query.count = nearestQuery(query.x, query.y, query.capacity, query.out);
+    break;
+  case SpatialQuery::Box:
+    query.count = boxQuery(query.x, query.y, query.x2, query.y2, query.out,
+                           query.capacity);
+    break;
+  case SpatialQuery::Ray: {
+    int hit = rayQuery(query.x, query.y, query.x2, query.y2, query.radius,
+                       &query.hitDistance);
+    query.count = 0;
+    if (hit >= 0 && query.capacity > 0) {
+      query.out[0] = hit;
+      query.count = 1;
+    }
+    break;
+  }
+  }
+}
 
-  for (int i = 0; i < m_particles.size(); ++i) {
+void Simulation::runQueries(SpatialQuery *queries, int count) {
+  // Below this many queries thread start-up costs more than it saves
+  const int parallelThreshold = 1024;
+
+  if (!prepareQueries()) {
+    for (int q = 0; q < count; ++q)
+      queries[q].count = 0;
+    return;
+  }
+
+  // Morton order of the query cells, so consecutive queries (and each
+  // thread's share) read overlapping parts of the grid
+  m_frameArena.reset();
+  uint32_t *keys = m_frameArena.allocate<uint32_t>(count);
+  int *order = m_frameArena.allocate<int>(count);
+  for (int q = 0; q < count; ++q) {
+    int gx = (int)(queries[q].x / m_cellSize);
+    int gy = (int)(queries[q].y / m_cellSize);
+    gx = std::max(0, std::min(gx, m_gridWidth - 1));
+    gy = std::max(0, std::min(gy, m_gridHeight - 1));
+    keys[q] = mortonKey(gx, gy);
+    order[q] = q;
+  }
+  radixSort(keys, order, count, m_frameArena, *m_pool);
+
+  int threadCount =
+      count >= parallelThreshold ? m_pool->getThreadCount() : 1;
+  m_pool->run(threadCount, [&](int t) {
+    int begin = (long long)count * t / threadCount;
+    int end = (long long)count * (t + 1) / threadCount;
+    for (int q = begin; q < end; ++q)
+      runQuery(queries[order[q]]);
+  });
+}
+
+// Per-archetype kernel. Traits supplies the tunables as compile-time
+// constants, so each instantiation folds them into its own loop.
+template <typename Traits>
+int Simulation::updateBlock(int begin, int end, const TickContext &ctx) {
+  const float jamSpeedSq = 1.0f; // Below 1 cell/s counts as stuck
+  int jammedCount = 0;
+
+  for (int i = begin; i < end; ++i) {
     Particle &p = m_particles[i];
 
-    // Reset acceleration
-    p.ax = 0;
-    p.ay = 0;
+    // Work on float copies, written back once at the end. Acceleration
+    // never leaves this loop body.
+    float x = p.x;
+    float y = p.y;
+    float vx = p.vx;
+    float vy = p.vy;
+    float ax = 0;
+    float ay = 0;
+
+    if (ctx.cellSpeeds) {
+      // Same cell as the grid filed it under this tick
+      int gx = (int)x / m_cellSize;
+      int gy = (int)y / m_cellSize;
+      if (gx >= 0 && gx < m_gridWidth && gy >= 0 && gy < m_gridHeight)
+        ctx.cellSpeeds[gy * m_gridWidth + gx] += std::sqrt(vx * vx + vy * vy);
+    }
+
+    // Update LOD: off screen and far from any goal, only every Nth zombie
+    // (by ID) moves this tick, N steps' worth
+    int rate = 1;
+    if (ctx.updateLod &&
+        (x < ctx.view.minX || x > ctx.view.maxX || y < ctx.view.minY ||
+         y > ctx.view.maxY)) {
+      int cx = std::max(0, std::min(ctx.width - 1, (int)x));
+      int cy = std::max(0, std::min(ctx.height - 1, (int)y));
+      int goalDistance = ctx.goalDistance[cy * ctx.width + cx];
+      if (goalDistance < 0 || goalDistance > kQuarterRateDistance)
+        rate = 4;
+      else if (goalDistance > kHalfRateDistance)
+        rate = 2;
+    }
+    if ((m_ids[i] + ctx.tick) % rate != 0) {
+      if (vx * vx + vy * vy < jamSpeedSq)
+        jammedCount++;
+      continue;
+    }
+    float dt = ctx.dt * rate;
 
     // 1. Flow Field Following
-    int ix = (int)p.x;
-    int iy = (int)p.y;
-    Map::Vector2 flow = m_map->getFlowAt(ix, iy);
+    int ix = (int)x;
+    int iy = (int)y;
+    Map::Vector2 flow = {0.0f, 0.0f};
+    if (ix >= 0 && ix < ctx.width && iy >= 0 && iy < ctx.height)
+      flow = ctx.flowField[iy * ctx.width + ix];
 
     // Desired velocity based on flow
-    float desiredX = flow.x * maxSpeed;
-    float desiredY = flow.y * maxSpeed;
+    float desiredX = flow.x * Traits::maxSpeed;
+    float desiredY = flow.y * Traits::maxSpeed;
 
     // Steering = Desired - Velocity
-    float steerX = desiredX - p.vx;
-    float steerY = desiredY - p.vy;
+    float steerX = desiredX - vx;
+    float steerY = desiredY - vy;
 
     // Limit steering force
     float steerLen = std::sqrt(steerX * steerX + steerY * steerY);
-    if (steerLen > maxForce) {
-      steerX = (steerX / steerLen) * maxForce;
-      steerY = (steerY / steerLen) * maxForce;
+    if (steerLen > Traits::maxForce) {
+      steerX = (steerX / steerLen) * Traits::maxForce;
+      steerY = (steerY / steerLen) * Traits::maxForce;
     }
 
     // Add randomness
-    float rx = ((float)std::rand() / RAND_MAX - 0.5f) * 10.0f;
-    float ry = ((float)std::rand() / RAND_MAX - 0.5f) * 10.0f;
+    float rx = 0;
+    float ry = 0;
+    if (ctx.jitter) {
+      rx = (randomUnit() - 0.5f) * 10.0f;
+      ry = (randomUnit() - 0.5f) * 10.0f;
+    }
 
-    p.ax += steerX + rx;
-    p.ay += steerY + ry;
+    ax += steerX + rx;
+    ay += steerY + ry;
 
     // 2. Separation
-    neighbors.clear();
-    getNeighbors(i, neighbors);
-
     float sepX = 0;
     float sepY = 0;
     int sepCount = 0;
 
-    for (int nIdx : neighbors) {
+    // At a reduced neighbour rate only every Nth zombie (by ID) looks this
+    // tick, and pushes N times as hard. Cell pairs run for everyone at once.
+    int neighborCount = 0;
+    bool query = ctx.useCellPairs
+                     ? ctx.tick % ctx.neighborInterval == 0
+                     : (m_ids[i] + ctx.tick) % ctx.neighborInterval == 0;
+    if (!query) {
+      // No separation this tick
+    } else if (ctx.useCellPairs) {
+      // Already summed pairwise, from positions at the start of the tick
+      sepX = m_separation[i].x;
+      sepY = m_separation[i].y;
+    } else if (ctx.useVerlet) {
+      neighborCount = getVerletNeighbors(i, ctx.neighbors);
+    } else {
+      neighborCount = getNeighbors(i, ctx.neighbors);
+    }
+
+    for (int k = 0; k < neighborCount; ++k) {
+      int nIdx = ctx.neighbors[k];
       if (nIdx == i)
         continue;
       const Particle &other = m_particles[nIdx];
-      float dx = p.x - other.x;
-      float dy = p.y - other.y;
+      float dx = x - other.x;
+      float dy = y - other.y;
       float dSq = dx * dx + dy * dy;
 
-      // Use user-defined size for separation
-      float minSep = m_zombieSize;
+      // User-defined size, scaled per archetype
+      float minSep = m_zombieSize * Traits::size;
       if (dSq > 0 && dSq < minSep * minSep) {
         float d = std::sqrt(dSq);
         // Stronger repulsive force closer we are
@@ -181,166 +1121,522 @@ void Simulation::update(float dt) {
                             // dx/d * (minSep-d) ? No dx/d * mag.
         // dx/d is normal. magnitude is (minSep - d). so dx/d * (minSep - d) =
         // dx * (minSep/d - 1). Let's use simple weighting: vector/distSq
-        sepX += (dx / d) * (minSep - d) * 50.0f; // 50.0f separation weight
-        sepY += (dy / d) * (minSep - d) * 50.0f;
+        sepX += (dx / d) * (minSep - d) * Traits::separationWeight;
+        sepY += (dy / d) * (minSep - d) * Traits::separationWeight;
         sepCount++;
       }
     }
 
-    p.ax += sepX;
-    p.ay += sepY;
+    // A zombie on a reduced update rate that is a multiple of the neighbour
+    // interval queries on every tick it moves, and dt already covers the gap
+    int separationScale = ctx.neighborInterval;
+    if (rate > 1 && !ctx.useCellPairs && rate % ctx.neighborInterval == 0)
+      separationScale = 1;
+    ax += sepX * separationScale;
+    ay += sepY * separationScale;
 
     // 3. Integration
-    p.vx += p.ax * dt;
-    p.vy += p.ay * dt;
+    vx += ax * dt;
+    vy += ay * dt;
 
     // Limit speed
-    float terrainMod = m_map->getSpeedModifier((int)p.x, (int)p.y);
-    float currentMaxSpeed = maxSpeed * terrainMod;
+    float terrainMod = m_map->getSpeedModifier((int)x, (int)y);
+    float currentMaxSpeed = Traits::maxSpeed * terrainMod;
 
-    float speedSq = p.vx * p.vx + p.vy * p.vy;
+    float speedSq = vx * vx + vy * vy;
     if (speedSq > currentMaxSpeed * currentMaxSpeed) {
       float speed = std::sqrt(speedSq);
       if (speed > 0) {
-        p.vx = (p.vx / speed) * currentMaxSpeed;
-        p.vy = (p.vy / speed) * currentMaxSpeed;
+        vx = (vx / speed) * currentMaxSpeed;
+        vy = (vy / speed) * currentMaxSpeed;
       }
     }
 
-    float nextX = p.x + p.vx * dt;
-    float nextY = p.y + p.vy * dt;
+    // 4. Wall Collision (signed distance field, swept)
+    // Large steps are split so no sub-step moves more than half a cell, which
+    // keeps fast movers from tunnelling through one-cell walls. On contact the
+    // particle is projected out along the SDF gradient and only the velocity
+    // component into the wall is removed, so it slides along instead of
+    // sticking.
+    float stepLen = std::sqrt(vx * vx + vy * vy) * dt;
+    int subSteps = std::max(1, (int)std::ceil(stepLen / 0.5f));
+    if (ctx.maxSubsteps > 0)
+      subSteps = std::min(subSteps, ctx.maxSubsteps);
+    float subDt = dt / subSteps;
 
-    // 4. Wall Collision (Simple slide)
-    int nix = (int)nextX;
-    int niy = (int)nextY;
-    if (nix >= 0 && nix < w && niy >= 0 && niy < h) {
-      if (m_map->getData()[niy * w + nix] == 0) {
-        p.x = nextX;
-        p.y = nextY;
-      } else {
-        // Hit wall, kill velocity perpendicular? Or just stop.
-        p.vx = 0;
-        p.vy = 0;
-        // Don't update pos
+    for (int s = 0; s < subSteps; ++s) {
+      x += vx * subDt;
+      y += vy * subDt;
+
+      float dist = m_map->getDistanceAt(x, y);
+      if (dist < ctx.wallRadius) {
+        Map::Vector2 n = m_map->getDistanceGradientAt(x, y);
+        x += n.x * (ctx.wallRadius - dist);
+        y += n.y * (ctx.wallRadius - dist);
+
+        float vn = vx * n.x + vy * n.y;
+        if (vn < 0) {
+          vx -= vn * n.x;
+          vy -= vn * n.y;
+        }
       }
-    } else {
-      // Map bounds
-      p.x = std::max(0.0f, std::min((float)w, nextX));
-      p.y = std::max(0.0f, std::min((float)h, nextY));
-    }
-
-    // 5. Goal Check
-    // Reuse iter erase logic?
-    // Doing erase in loop with index access is tricky.
-    // Better to mark for deletion or swap-remove.
-    // Let's stick to simple loop structure but be careful.
-    // Actually, "update" loop above is index based.
-    // Let's do a second pass for removal or handle it here with swap-back?
-    // Swap-back changes indices, breaking updateGrid/neighbors if done
-    // mid-frame. Actually, updateGrid is done once. If I swap-back, indices
-    // change. So if I process i, and swap last into i, I need to process i
-    // again. But grid refers to old indices! Safest: Use `erase` but iterate
-    // backwards? Or just mark dead. Or just simple erase and adjust `i` and
-    // rebuild grid next frame. Performance hit of erase is O(N), but we only
-    // erase a few per frame.
-  }
-
-  // Cleanup loop
-  for (auto it = m_particles.begin(); it != m_particles.end();) {
-    float distanceSq = (it->x - centerX) * (it->x - centerX) +
-                       (it->y - centerY) * (it->y - centerY);
-    if (distanceSq < goalRadiusSq) {
-      m_score++;
-      it = m_particles.erase(it);
-    } else {
-      ++it;
     }
+
+    // Map bounds
+    p.x = std::max(0.0f, std::min((float)ctx.width, x));
+    p.y = std::max(0.0f, std::min((float)ctx.height, y));
+    p.vx = vx;
+    p.vy = vy;
+
+    // Reached a goal: sunk once the kernels are done
+    ix = (int)p.x;
+    iy = (int)p.y;
+    if (ix < ctx.width && iy < ctx.height &&
+        ctx.goalIds[iy * ctx.width + ix]) {
+      m_sunk.push_back(i);
+      continue;
+    }
+    if (vx * vx + vy * vy < jamSpeedSq)
+      jammedCount++;
   }
+  return jammedCount;
 }
 
-void Simulation::render() {
-  if (m_textureID != 0) {
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, m_textureID);
-    glColor3f(1.0f, 1.0f, 1.0f); // White modulation
-  } else {
-    glDisable(GL_TEXTURE_2D);
-    glColor3f(0.0f, 1.0f, 0.0f); // Green fallback
-    glPointSize(m_zombieSize * 2.0f);
-    glBegin(GL_POINTS);
-  }
+void Simulation::update(float dt) {
+  double tickStart = m_metrics ? Instrumentation::now() : 0.0;
+  int scoreBefore = m_score;
+  int jammedCount = 0;
 
   int w = m_map->getWidth();
   int h = m_map->getHeight();
 
-  // Use display list or arrays for performance? Immediate mode is slow for 5000
-  // particles. But for now, keep immediate mode.
+  float wallRadius = 0.45f; // Fits one-cell corridors (SDF 0.5 at centre)
+
+  int rowBegin = m_domainBegin;
+  int rowEnd = m_domainEnd < 0 ? h : m_domainEnd;
+
+  // Ghosts change every tick and have no IDs, so a domain that has any
+  // always uses the grid.
+  bool useVerlet =
+      m_neighborStrategy == NeighborStrategy::Verlet && m_ghosts.empty();
+
+  m_frameArena.reset();
+
+  // Continuous Spawning
+  // The cap is global: particles owned by other domains count against it.
+  if (m_particles.size() + m_pendingSpawns.size() + m_remoteParticleCount <
+      kMaxParticles) {
+    // ... (Spawning logic can remain same or be refactored, keeping it minimal
+    // for diff size) Re-implementing simplified spawning for this block
+    for (int i = 0; i < 5; ++i) { // 5 per frame
+      int side = nextSpawnRandom() % 4;
+      int lx, ly;
+      // ... (Edge logic)
+      if (side == 0) {
+        lx = 0;
+        ly = nextSpawnRandom() % h;
+      } else if (side == 1) {
+        lx = w - 1;
+        ly = nextSpawnRandom() % h;
+      } else if (side == 2) {
+        lx = nextSpawnRandom() % w;
+        ly = 0;
+      } else {
+        lx = nextSpawnRandom() % w;
+        ly = h - 1;
+      }
+
+      // In a domain-decomposed run every domain rolls the same spawn
+      // attempts (they share the spawn seed) and keeps only the ones
+      // landing in its rows.
+      if (ly < rowBegin || ly >= rowEnd)
+        continue;
 
-  if (m_textureID == 0) {
-    // Fallback Rendering
-    for (const auto &p : m_particles) {
-      float glX = (p.x / w) * 2.0f - 1.0f;
-      float glY = -((p.y / h) * 2.0f - 1.0f);
-      glVertex2f(glX, glY);
+      if (m_map->getData()[ly * w + lx] == 0) {
+        Particle p = {(float)lx + 0.5f, (float)ly + 0.5f, 0, 0};
+        ZombieType type = pickType();
+        if (useVerlet)
+          m_pendingSpawns.push_back({p, type});
+        else
+          pushParticle(p, type);
+      }
+    }
+  }
+
+  m_tickCount++;
+
+  // Hand the crowd to the background field builder; whatever build has
+  // landed is what this tick steers by.
+  const Map::Vector2 *flowField = nullptr;
+  if (m_congestionInterval > 0) {
+    if (!m_congestion)
+      m_congestion.reset(new CongestionField(m_map));
+    if (m_tickCount % m_congestionInterval == 0)
+      m_congestion->submit(m_particles);
+    flowField = m_congestion->current();
+  }
+  if (!flowField)
+    flowField = m_map->getFlowField().data();
+
+  // Keep storage roughly in grid order so neighbour reads stay in cache
+  if (m_reorderInterval > 0 && m_tickCount % m_reorderInterval == 0) {
+    m_reorderDue = true;
+  }
+
+  if (useVerlet) {
+    m_verletAge++;
+    if (verletNeedsRebuild()) {
+      for (const auto &spawn : m_pendingSpawns) {
+        pushParticle(spawn.particle, spawn.type);
+      }
+      m_pendingSpawns.clear();
+      if (m_reorderDue) {
+        reorderParticles();
+        m_reorderDue = false;
+      }
+      updateGrid();
+      buildVerletLists();
     }
-    glEnd();
-    glPointSize(1.0f);
   } else {
-    // Textured Quads
-    // We need to render in world space or screen space?
-    // Map render translates to coordinate system where 0..width is mapped to
-    // -1..1 or similar? Wait, Map::render draws in 0..width, 0..height. And
-    // Game::render scales it... wait. Game::render does: glScalef(m_zoom,
-    // m_zoom, 1.0f); glTranslatef(m_offsetX, m_offsetY, 0.0f); And then calls
-    // Map::render.
-
-    // I previously used -1..1 in Simulation::render, which was WRONG if
-    // Map::render uses 0..width. Let's align with Map::render which seems to
-    // use cell coordinates directly.
-
-    // Map::render code:
-    // glRectf(x, y, x + 1.0f, y + 1.0f);
-    // This means Map draws from (0,0) to (width, height).
-
-    // So Simulation should also draw in (0,0) to (width, height) space.
-    // My previous Simulation::render used -1..1. That was probably rendering
-    // tiny dots in the center! I need to fix this to use p.x, p.y directly.
-
-    float size = m_zombieSize;
-
-    for (const auto &p : m_particles) {
-      float x = p.x;
-      float y = p.y;
-      float vx = p.vx;
-      float vy = p.vy;
-
-      float angle = 0.0f;
-      if (vx != 0 || vy != 0) {
-        angle = std::atan2(vy, vx) * 180.0f / 3.14159f;
+    if (!m_pendingSpawns.empty()) {
+      for (const auto &spawn : m_pendingSpawns) {
+        pushParticle(spawn.particle, spawn.type);
       }
+      m_pendingSpawns.clear();
+      m_verletDirty = true;
+    }
+    if (m_reorderDue) {
+      reorderParticles();
+      m_reorderDue = false;
+    }
+  }
+
+  // Ghosts ride along at the end of m_particles so the grid and neighbour
+  // lookup see them, but only owned particles are integrated. m_ghosts keeps
+  // their types until the end of the tick.
+  int ownedCount = m_blockStart[kZombieTypeCount];
+  for (const auto &ghost : m_ghosts) {
+    m_particles.push_back(ghost.particle);
+  }
+
+  bool useCellPairs = m_neighborStrategy == NeighborStrategy::CellPairs;
 
-      glPushMatrix();
-      glTranslatef(x, y, 0.0f);
-      glRotatef(angle, 0.0f, 0.0f, 1.0f);
+  // The heatmap reads cell counts off the grid, which Verlet ticks only
+  // build on a rebuild
+  if (!useVerlet || (m_heatmap && !m_gridCurrent))
+    updateGrid();
+  if (m_heatmap)
+    m_cellSpeeds.assign(m_gridWidth * m_gridHeight, 0.0f);
+  if (useCellPairs && m_tickCount % m_neighborInterval == 0)
+    accumulateCellPairSeparation();
 
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  // No particle can have more candidates than there are particles
+  int *neighbors = m_frameArena.allocate<int>(m_particles.size());
 
-      glBegin(GL_QUADS);
-      glTexCoord2f(0, 0);
-      glVertex2f(-size / 2, -size / 2);
-      glTexCoord2f(1, 0);
-      glVertex2f(size / 2, -size / 2);
-      glTexCoord2f(1, 1);
-      glVertex2f(size / 2, size / 2);
-      glTexCoord2f(0, 1);
-      glVertex2f(-size / 2, size / 2);
-      glEnd();
+  TickContext ctx;
+  ctx.dt = dt;
+  ctx.width = w;
+  ctx.height = h;
+  ctx.wallRadius = wallRadius;
+  ctx.useVerlet = useVerlet;
+  ctx.useCellPairs = useCellPairs;
+  ctx.neighbors = neighbors;
+  ctx.flowField = flowField;
+  ctx.tick = m_tickCount;
+  ctx.neighborInterval = m_neighborInterval;
+  ctx.jitter = m_jitter;
+  ctx.maxSubsteps = m_maxSubsteps;
+  ctx.updateLod = m_updateLod;
+  ctx.view = {m_updateView.minX - kViewMargin, m_updateView.minY - kViewMargin,
+              m_updateView.maxX + kViewMargin, m_updateView.maxY + kViewMargin};
+  ctx.goalIds = m_map->getGoalIds().data();
+  ctx.goalDistance = m_map->getGoalDistances().data();
+  ctx.cellSpeeds = m_heatmap ? m_cellSpeeds.data() : nullptr;
 
-      glDisable(GL_BLEND);
+  m_sunk.clear();
+  for (int t = 0; t < kZombieTypeCount; ++t) {
+    int begin = m_blockStart[t];
+    int end = m_blockStart[t + 1];
+    switch ((ZombieType)t) {
+    case ZombieType::Walker:
+      jammedCount += updateBlock<WalkerTraits>(begin, end, ctx);
+      break;
+    case ZombieType::Runner:
+      jammedCount += updateBlock<RunnerTraits>(begin, end, ctx);
+      break;
+    case ZombieType::Brute:
+      jammedCount += updateBlock<BruteTraits>(begin, end, ctx);
+      break;
+    case ZombieType::Crawler:
+      jammedCount += updateBlock<CrawlerTraits>(begin, end, ctx);
+      break;
+    default:
+      break;
+    }
+  }
+
+  m_particles.resize(ownedCount);
+  m_ghosts.clear();
+  m_gridCurrent = false; // Everyone moved, and ghosts are gone
+
+  // Sink whoever the kernels found on a goal. Indices are ascending, and
+  // removing from the back first keeps the lower ones valid: a removal only
+  // moves particles from above the hole.
+  for (int k = (int)m_sunk.size() - 1; k >= 0; --k) {
+    int index = m_sunk[k];
+    const Particle &p = m_particles[index];
+    m_goalScores[m_map->getGoalIds()[(int)p.y * w + (int)p.x] - 1]++;
+    m_score++;
+    removeParticleAt(index);
+  }
 
-      glPopMatrix();
+  if (m_metrics) {
+    TickSample sample;
+    sample.tickTime = Instrumentation::now() - tickStart;
+    sample.sunk = m_score - scoreBefore;
+    sample.particleCount = m_particles.size();
+    sample.jammedCount = jammedCount;
+    sample.flowFieldTime = m_map->getFlowFieldBuildTime();
+    m_metrics->record(sample);
+  }
+}
+
+void Simulation::writeSnapshot(CrowdSnapshot &snapshot) const {
+  int n = m_blockStart[kZombieTypeCount]; // Owned particles only
+  snapshot.zombies.resize(n);
+  for (int i = 0; i < n; ++i) {
+    const Particle &p = m_particles[i];
+    float vx = p.vx;
+    float vy = p.vy;
+
+    // cos/sin of the heading straight from the velocity, no atan2 needed
+    CrowdSnapshot::Zombie &z = snapshot.zombies[i];
+    z.x = p.x;
+    z.y = p.y;
+    z.c = 1.0f;
+    z.s = 0.0f;
+    float speed = std::sqrt(vx * vx + vy * vy);
+    if (speed > 0) {
+      z.c = vx / speed;
+      z.s = vy / speed;
     }
   }
+  std::copy(m_blockStart, m_blockStart + kZombieTypeCount + 1,
+            snapshot.blockStart);
+
+  // Counting sort into tiles. Counts go two slots up so that after the
+  // prefix sum tileStart[t + 1] is where tile t starts; scattering bumps it
+  // to where tile t ends, which leaves tileStart[0..tiles] as the CSR rows.
+  const int tile = CrowdSnapshot::kTile;
+  int tilesX = (m_map->getWidth() + tile - 1) / tile;
+  int tilesY = (m_map->getHeight() + tile - 1) / tile;
+  int tileCount = tilesX * tilesY;
+  snapshot.tilesX = tilesX;
+  snapshot.tilesY = tilesY;
+  snapshot.tileStart.assign(tileCount + 2, 0);
+  snapshot.tileZombies.resize(n);
+  auto tileOf = [&](const CrowdSnapshot::Zombie &z) {
+    int tx = std::max(0, std::min(tilesX - 1, (int)z.x / tile));
+    int ty = std::max(0, std::min(tilesY - 1, (int)z.y / tile));
+    return ty * tilesX + tx;
+  };
+  for (int i = 0; i < n; ++i)
+    snapshot.tileStart[tileOf(snapshot.zombies[i]) + 2]++;
+  for (int t = 2; t < tileCount + 2; ++t)
+    snapshot.tileStart[t] += snapshot.tileStart[t - 1];
+  for (int i = 0; i < n; ++i)
+    snapshot.tileZombies[snapshot.tileStart[tileOf(snapshot.zombies[i]) + 1]++] =
+        i;
+
+  snapshot.gridWidth = m_gridWidth;
+  snapshot.gridHeight = m_gridHeight;
+  snapshot.cellSize = m_cellSize;
+  snapshot.cellCounts.clear();
+  snapshot.cellSpeeds.clear();
+  if (m_heatmap && !m_cellSpeeds.empty()) {
+    int cellCount = m_gridWidth * m_gridHeight;
+    snapshot.cellCounts.resize(cellCount);
+    for (int c = 0; c < cellCount; ++c)
+      snapshot.cellCounts[c] = m_cellStart[c + 1] - m_cellStart[c];
+    snapshot.cellSpeeds = m_cellSpeeds;
+  }
+  snapshot.tick = m_tickCount;
+
+  snapshot.zombieSize = m_zombieSize;
+  snapshot.score = m_score;
+}
+
+int Simulation::cullToView(const CrowdSnapshot &snapshot,
+                           int *visible) const {
+  int n = snapshot.zombies.size();
+  if (!m_renderViewSet || snapshot.tileStart.empty()) {
+    for (int i = 0; i < n; ++i)
+      visible[i] = i;
+    return n;
+  }
+
+  // Sprites reach past their centres, so pad by the largest body
+  float pad = 0.0f;
+  for (int t = 0; t < kZombieTypeCount; ++t)
+    pad = std::max(pad, zombieTypeSize((ZombieType)t));
+  pad *= snapshot.zombieSize;
+
+  const int tile = CrowdSnapshot::kTile;
+  int tx0 = std::max(0, (int)std::floor((m_renderView.minX - pad) / tile));
+  int ty0 = std::max(0, (int)std::floor((m_renderView.minY - pad) / tile));
+  int tx1 = std::min(snapshot.tilesX - 1,
+                     (int)std::floor((m_renderView.maxX + pad) / tile));
+  int ty1 = std::min(snapshot.tilesY - 1,
+                     (int)std::floor((m_renderView.maxY + pad) / tile));
+
+  // The tiles of a row are adjacent in tileZombies, one run per row
+  int count = 0;
+  for (int ty = ty0; ty <= ty1 && tx0 <= tx1; ++ty) {
+    int begin = snapshot.tileStart[ty * snapshot.tilesX + tx0];
+    int end = snapshot.tileStart[ty * snapshot.tilesX + tx1 + 1];
+    std::copy(snapshot.tileZombies.begin() + begin,
+              snapshot.tileZombies.begin() + end, visible + count);
+    count += end - begin;
+  }
+  return count;
+}
+
+void Simulation::render(const CrowdSnapshot &snapshot) {
+  const std::vector<CrowdSnapshot::Zombie> &zombies = snapshot.zombies;
+  m_renderArena.reset();
+  int *visible = m_renderArena.allocate<int>(zombies.size());
+  int n = cullToView(snapshot, visible);
+
+  if (m_renderLod == RenderLod::Density) {
+    renderDensity(snapshot, visible, n);
+    return;
+  }
+
+  if (m_textureID == 0 || m_renderLod == RenderLod::Points) {
+    // Points, also the fallback without a sprite. Map cell coordinates like
+    // the quads below.
+    float *vertices = m_renderArena.allocate<float>(n * 2);
+    for (int v = 0; v < n; ++v) {
+      vertices[v * 2] = zombies[visible[v]].x;
+      vertices[v * 2 + 1] = zombies[visible[v]].y;
+    }
+
+    glDisable(GL_TEXTURE_2D);
+    glColor3f(0.0f, 1.0f, 0.0f); // Green fallback
+    glPointSize(snapshot.zombieSize * 2.0f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, vertices);
+    glDrawArrays(GL_POINTS, 0, n);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPointSize(1.0f);
+    return;
+  }
+
+  // Textured Quads, in map cell coordinates like Map::render. Each quad is
+  // rotated to face along the heading on the CPU and the whole crowd goes
+  // out in a single draw call instead of a matrix push and glBegin per
+  // zombie.
+  float *vertices = m_renderArena.allocate<float>(n * 8);
+  float *texCoords = m_renderArena.allocate<float>(n * 8);
+  const float corners[4][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f},
+                               {-0.5f, 0.5f}};
+  const float uvs[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  float sizes[kZombieTypeCount];
+  for (int t = 0; t < kZombieTypeCount; ++t)
+    sizes[t] = snapshot.zombieSize * zombieTypeSize((ZombieType)t);
+
+  for (int v = 0; v < n; ++v) {
+    // Types are stored in contiguous blocks; culling visits them out of
+    // order, so find the block
+    int i = visible[v];
+    int type = 0;
+    while (type + 1 < kZombieTypeCount && i >= snapshot.blockStart[type + 1])
+      type++;
+    float size = sizes[type];
+    const CrowdSnapshot::Zombie &z = zombies[i];
+
+    for (int k = 0; k < 4; ++k) {
+      float cx = corners[k][0] * size;
+      float cy = corners[k][1] * size;
+      vertices[v * 8 + k * 2] = z.x + cx * z.c - cy * z.s;
+      vertices[v * 8 + k * 2 + 1] = z.y + cx * z.s + cy * z.c;
+      texCoords[v * 8 + k * 2] = uvs[k][0];
+      texCoords[v * 8 + k * 2 + 1] = uvs[k][1];
+    }
+  }
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, m_textureID);
+  glColor3f(1.0f, 1.0f, 1.0f); // White modulation
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertices);
+  glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
+  glDrawArrays(GL_QUADS, 0, n * 4);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  glDisable(GL_BLEND);
+  glDisable(GL_TEXTURE_2D);
+}
+
+void Simulation::renderDensity(const CrowdSnapshot &snapshot,
+                               const int *visible, int visibleCount) {
+  // One quad per block of kBlock x kBlock map cells, more opaque the more
+  // zombies it holds; a block packed at one zombie per cell is fully red.
+  const int kBlock = 4;
+  int bw = (m_map->getWidth() + kBlock - 1) / kBlock;
+  int bh = (m_map->getHeight() + kBlock - 1) / kBlock;
+  int *counts = m_renderArena.allocate<int>(bw * bh);
+  std::fill(counts, counts + bw * bh, 0);
+
+  int occupied = 0;
+  for (int v = 0; v < visibleCount; ++v) {
+    const CrowdSnapshot::Zombie &z = snapshot.zombies[visible[v]];
+    int bx = std::max(0, std::min(bw - 1, (int)z.x / kBlock));
+    int by = std::max(0, std::min(bh - 1, (int)z.y / kBlock));
+    if (counts[by * bw + bx]++ == 0)
+      occupied++;
+  }
+
+  float *vertices = m_renderArena.allocate<float>(occupied * 8);
+  float *colors = m_renderArena.allocate<float>(occupied * 16);
+  int quad = 0;
+  for (int by = 0; by < bh; ++by) {
+    for (int bx = 0; bx < bw; ++bx) {
+      int count = counts[by * bw + bx];
+      if (count == 0)
+        continue;
+      float x0 = bx * kBlock;
+      float y0 = by * kBlock;
+      float x1 = x0 + kBlock;
+      float y1 = y0 + kBlock;
+      const float corners[8] = {x0, y0, x1, y0, x1, y1, x0, y1};
+      std::copy(corners, corners + 8, vertices + quad * 8);
+      float alpha = std::min(1.0f, 0.2f + (float)count / (kBlock * kBlock));
+      for (int k = 0; k < 4; ++k) {
+        float *c = colors + quad * 16 + k * 4;
+        c[0] = 1.0f;
+        c[1] = 0.2f;
+        c[2] = 0.1f;
+        c[3] = alpha;
+      }
+      quad++;
+    }
+  }
+
   glDisable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertices);
+  glColorPointer(4, GL_FLOAT, 0, colors);
+  glDrawArrays(GL_QUADS, 0, occupied * 4);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_BLEND);
 }
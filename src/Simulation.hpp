@@ -1,41 +1,423 @@
 #pragma once
+#include "Archetypes.hpp"
+#include "FixedPoint.hpp"
+#include "FrameArena.hpp"
 #include "Map.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
 #include <vector>
 
+class CongestionField;
+class Metrics;
+class WorkerPool;
+
+// How update() finds separation candidates. Grid rescans the 3x3 cells
+// around each particle every tick; Verlet keeps per-particle lists within
+// (zombie size + skin) and rebuilds them only once something may have moved
+// past half the skin. CellPairs walks each pair of neighbouring grid cells
+// once (half stencil) before integration and applies equal and opposite
+// forces, so every pair costs one distance evaluation instead of two.
+enum class NeighborStrategy { Grid, Verlet, CellPairs };
+
+// How render() draws the crowd: rotated sprites, one point per zombie, or
+// a coarse density map with one translucent quad per occupied block.
+enum class RenderLod { Sprites, Points, Density };
+
+// Persistent per-zombie state. Acceleration only lives for one tick and is
+// kept in locals inside update(). The archetype is not stored per zombie:
+// it follows from the block of storage the zombie sits in. The compact
+// layout (12 bytes instead of 16) trades float storage for 16.16 fixed-point
+// positions and int16 velocities; fields still read and assign as float.
+#ifdef ZOMBIE_COMPACT_PARTICLES
+struct Particle {
+  Fixed16_16 x, y;
+  PackedVelocity vx, vy;
+};
+#else
 struct Particle {
   float x, y;
   float vx, vy;
-  float ax, ay;
+};
+#endif
+
+// A zombie with its archetype, as handed from one domain to another
+struct TypedParticle {
+  Particle particle;
+  ZombieType type;
+};
+
+// A rectangle of the map in map cell coordinates, e.g. what the camera
+// shows
+struct ViewRect {
+  float minX, minY, maxX, maxY;
+};
+
+// What rendering needs of one tick, copied out of the simulation so it can
+// be drawn on another thread while the next tick runs. Headings are unit
+// vectors along the velocity; zombies keep the simulation's block order.
+// The tile index lists zombies by kTile x kTile blocks of map cells (CSR,
+// tiles in row order) so a view only walks the tiles it overlaps.
+struct CrowdSnapshot {
+  struct Zombie {
+    float x, y;
+    float c, s;
+  };
+  std::vector<Zombie> zombies;
+  int blockStart[kZombieTypeCount + 1] = {};
+
+  static const int kTile = 16;
+  int tilesX = 0;
+  int tilesY = 0;
+  std::vector<int> tileStart; // Tile -> first entry in tileZombies
+  std::vector<int> tileZombies;
+
+  // Crowd heatmap on the simulation grid (cellSize map cells per side),
+  // only while Simulation::setHeatmap is on: zombies per cell, taken from
+  // the grid, and the sum of their speeds at the start of the tick.
+  int gridWidth = 0;
+  int gridHeight = 0;
+  int cellSize = 0;
+  std::vector<uint16_t> cellCounts;
+  std::vector<float> cellSpeeds; // Cells/s, summed over the cell's zombies
+  int tick = 0;
+  float zombieSize = 1.0f;
+  int score = 0;
+};
+
+// One request for Simulation::runQueries. Results are particle indices
+// written to out (room for capacity of them); count receives how many.
+struct SpatialQuery {
+  enum Type { Radius, Nearest, Box, Ray };
+  Type type;
+  float x, y;   // Centre, ray origin or box min corner
+  float x2, y2; // Box max corner or ray direction
+  float radius; // Radius, or ray length
+  int *out;
+  int capacity; // For Nearest also k
+  int count;
+  float hitDistance; // Ray only, along the direction
 };
 
 class Simulation {
 public:
-  Simulation(Map *map);
+  // The map is only read, so any number of simulations can share one
+  Simulation(const Map *map);
   ~Simulation();
 
   void init(int particleCount);
+  // Spawn positions, archetypes and steering jitter come from random
+  // streams of the simulation's own, seeded from std::rand() unless set here
+  // (before init() to cover the initial crowd)
+  void setSeed(unsigned int seed) {
+    m_random.seed(seed);
+    m_spawnRandom.seed(seed ^ 0x9e3779b9u);
+  }
+  // Edge spawn attempts have a stream to themselves. Domains of one run are
+  // given the same spawn seed, so they all roll the same attempts and each
+  // keeps the ones landing in its rows.
+  void setSpawnSeed(unsigned int seed) { m_spawnRandom.seed(seed); }
+  // Threads for the parallel passes of a tick, counting the caller; 0 (the
+  // default) means parallelThreadCount(). Callers that already run many
+  // simulations side by side pass 1. Takes effect at init().
+  void setThreadCount(int count) { m_threadCount = count; }
   void update(float dt); // dt in seconds
-  void render();
+
+  // Snapshots are written on the simulation thread and may be rendered on
+  // another one: render() only reads the snapshot, the texture and its own
+  // scratch.
+  void writeSnapshot(CrowdSnapshot &snapshot) const;
+  void render(const CrowdSnapshot &snapshot);
+  void setRenderLod(RenderLod lod) { m_renderLod = lod; }
+  // Render thread. Only zombies in tiles overlapping the view are drawn;
+  // until this is called everything is.
+  void setRenderView(const ViewRect &view) {
+    m_renderView = view;
+    m_renderViewSet = true;
+  }
+
+  // Turns on update LOD: zombies outside `view` (plus a margin) and far
+  // from every goal integrate every 2nd or 4th tick only, with a step that
+  // long, staggered by ID so every tick does a similar share.
+  void setUpdateView(const ViewRect &view) {
+    m_updateView = view;
+    m_updateLod = true;
+  }
+
+  // Cheaper, coarser ticks for when frames run over budget. Each zombie
+  // queries separation neighbours every `ticks` ticks only (staggered by ID,
+  // the force scaled up to match); jitter is the random steering noise;
+  // substeps caps the wall-collision substeps per tick (0 = no cap).
+  void setNeighborInterval(int ticks) {
+    m_neighborInterval = std::max(1, ticks);
+  }
+  void setJitter(bool enabled) { m_jitter = enabled; }
+  void setMaxSubsteps(int substeps) { m_maxSubsteps = substeps; }
+
+  // Steer by a congestion-aware flow field rebuilt in the background from
+  // crowd positions every `ticks` ticks (see CongestionField); 0 keeps the
+  // map's static field. Until the first build lands the static field is
+  // used.
+  void setCongestionInterval(int ticks) { m_congestionInterval = ticks; }
+
+  // Fill the heatmap part of snapshots (see CrowdSnapshot). Density comes
+  // from the grid's cell counts and speeds are summed in the integration
+  // pass, so this costs no extra pass over the crowd.
+  void setHeatmap(bool enabled) { m_heatmap = enabled; }
+  int getCongestionBuildCount() const;
 
   void setTexture(unsigned int textureID) { m_textureID = textureID; }
+  // Report tick time, sinks and crowd figures to `metrics` after each
+  // update(); nullptr turns reporting off.
+  void setMetrics(Metrics *metrics) { m_metrics = metrics; }
   void setZombieSize(float size) { m_zombieSize = size; }
 
-  int getScore() const { return m_score; }
+  int getScore() const { return m_score; } // All goals together
+  // Zombies sunk in each of the map's goals (see Map::getGoal)
+  int getGoalScore(int goal) const {
+    return goal >= 0 && goal < Map::kMaxGoals ? m_goalScores[goal] : 0;
+  }
   int getParticleCount() const { return m_particles.size(); }
 
+  const std::vector<Particle> &getParticles() const { return m_particles; }
+  void setParticles(const std::vector<Particle> &particles);
+  void addParticles(const std::vector<Particle> &particles);
+  void addParticles(const std::vector<TypedParticle> &particles);
+
+  // Stable particle IDs. Storage order changes when particles are reordered
+  // or removed; the ID of a live particle does not. getParticleIndex returns
+  // -1 once that particle has sunk or left this domain.
+  int getParticleId(int index) const { return m_ids[index]; }
+  int getParticleIndex(int id) const;
+
+  // Archetypes. Storage holds one contiguous block per type, in ZombieType
+  // order. New zombies are drawn from the mix (fractions of runners, brutes
+  // and crawlers; walkers make up the rest). Plain Particles handed in
+  // through setParticles/addParticles are walkers.
+  void setTypeMix(float runners, float brutes, float crawlers);
+  ZombieType getParticleType(int index) const;
+  int getTypeCount(ZombieType type) const {
+    return m_blockStart[(int)type + 1] - m_blockStart[(int)type];
+  }
+
+  // Spatial queries over owned zombies, answered from the cell grid (rebuilt
+  // on the first query after anything moved). Results are particle indices,
+  // valid until the next update(); getParticleId gives a handle that lasts.
+  // Indices go into the caller's buffer, at most `capacity` of them, and the
+  // count found is returned; nothing is allocated. Zombies on or past the
+  // map edge are not in the grid and never show up. Call from the thread
+  // that runs update().
+  int queryRadius(float x, float y, float radius, int *out, int capacity);
+  // The k closest, nearest first
+  int queryNearest(float x, float y, int k, int *out);
+  int queryBox(float minX, float minY, float maxX, float maxY, int *out,
+               int capacity);
+  // First zombie whose body (its archetype's size) the ray from (x, y) along
+  // (dx, dy) touches within maxDistance; -1 if none. hitDistance receives
+  // the distance along the normalised direction.
+  int queryRay(float x, float y, float dx, float dy, float maxDistance,
+               float *hitDistance);
+  // Many queries at once, e.g. every turret each tick. They are sorted by
+  // grid cell so neighbouring queries share cache, and large batches run on
+  // several threads.
+  void runQueries(SpatialQuery *queries, int count);
+
+  // Sort particle storage along a Morton curve of grid cells every `ticks`
+  // updates so grid neighbours sit close in memory. 0 disables it.
+  void setReorderInterval(int ticks) { m_reorderInterval = ticks; }
+
+  void setNeighborStrategy(NeighborStrategy strategy);
+  // Wider skins mean longer lists but fewer rebuilds. Walkers move about
+  // 0.17 px a tick, so the default 3 px rebuilds every 9 ticks or so; 1 px
+  // rebuilt every 3 and was no faster than the grid.
+  void setVerletSkin(float skin) { m_verletSkin = skin; }
+  int getVerletRebuildCount() const { return m_verletRebuilds; }
+
+  // Domain decomposition: restrict spawning and ownership to map rows
+  // [rowBegin, rowEnd). Ghosts are read-only neighbours owned by another
+  // domain; they take part in separation for the next update() only.
+  void setDomain(int rowBegin, int rowEnd);
+  void setGhosts(const std::vector<TypedParticle> &ghosts) {
+    m_ghosts = ghosts;
+  }
+  void setRemoteParticleCount(int count) { m_remoteParticleCount = count; }
+  void collectHalo(int rows, std::vector<TypedParticle> &up,
+                   std::vector<TypedParticle> &down) const;
+  void extractMigrants(std::vector<TypedParticle> &up,
+                       std::vector<TypedParticle> &down);
+
 private:
-  Map *m_map;
+  const Map *m_map;
   std::vector<Particle> m_particles;
   int m_score;
+  std::vector<int> m_goalScores; // Map::kMaxGoals, so goals added to the
+                                 // map later never make update() allocate
+  std::vector<int> m_sunk; // Indices that reached a goal this tick;
+                           // reserved in init()
+  std::minstd_rand m_random;
+  int nextRandom() { return m_random() - 1; } // [0, 2^31 - 3]
+  float randomUnit() {
+    return (float)nextRandom() / (std::minstd_rand::max() - 1);
+  }
+  std::minstd_rand m_spawnRandom;
+  int nextSpawnRandom() { return m_spawnRandom() - 1; }
   unsigned int m_textureID;
   float m_zombieSize;
+  RenderLod m_renderLod;
+  ViewRect m_renderView;
+  bool m_renderViewSet;
+
+  // Update LOD. Off screen, zombies whose path to the nearest goal is longer
+  // than the first distance tick at half rate and beyond the second (or with
+  // no path at all) at quarter rate.
+  static constexpr float kViewMargin = 8.0f; // Cells around the view
+  static constexpr float kHalfRateDistance = 64.0f;
+  static constexpr float kQuarterRateDistance = 192.0f;
+  ViewRect m_updateView;
+  bool m_updateLod;
+
+  int m_neighborInterval;
+  bool m_jitter;
+  int m_maxSubsteps;
+
+  int m_congestionInterval;
+
+  bool m_heatmap;
+  std::vector<float> m_cellSpeeds; // Per grid cell, this tick
+  std::unique_ptr<CongestionField> m_congestion; // Created on first use
+
+  // Owned rows; the whole map unless setDomain() was called
+  int m_domainBegin;
+  int m_domainEnd;
+  std::vector<TypedParticle> m_ghosts;
+  int m_remoteParticleCount;
+
+  int domainRow(float y) const;
+
+  // ID indirection: m_ids is parallel to the owned part of m_particles
+  std::vector<int> m_ids;       // Slot -> ID
+  std::vector<int> m_idToIndex; // ID -> slot, -1 if unused
+  std::vector<int> m_freeIds;
+
+  void pushParticle(const Particle &p, ZombieType type);
+  void releaseId(int id);
+  // Inverse of pushParticle: the block's last particle fills the hole and
+  // each later block passes its last one down, so order is not kept
+  void removeParticleAt(int index);
+  void rebuildIdIndex();
+
+  // Block t spans [m_blockStart[t], m_blockStart[t + 1]); the last entry is
+  // the owned particle count.
+  int m_blockStart[kZombieTypeCount + 1];
+  float m_typeMix[kZombieTypeCount]; // Cumulative spawn probabilities
+
+  ZombieType pickType();
+  float largestTypeSize() const; // Among types with live particles
+  // Drop owned particles for which remove(p, type) is true, keeping order,
+  // blocks and the ID table in step
+  template <typename Fn> void removeParticles(Fn remove);
+
+  // Everything the per-type kernels share for one tick
+  struct TickContext {
+    float dt;
+    int width, height;
+    float wallRadius;
+    bool useVerlet, useCellPairs;
+    int *neighbors;
+    const Map::Vector2 *flowField; // Map-sized
+    int tick;
+    int neighborInterval;
+    bool jitter;
+    int maxSubsteps;
+    bool updateLod;
+    ViewRect view; // With the margin
+    const unsigned char *goalIds;  // Map-sized, see Map::getGoalIds
+    const int *goalDistance;       // Map-sized
+    float *cellSpeeds; // Grid-sized, nullptr without the heatmap
+  };
+
+  // Integrates particles [begin, end), all of archetype Traits; returns how
+  // many ended up jammed
+  template <typename Traits>
+  int updateBlock(int begin, int end, const TickContext &ctx);
 
-  // Spatial Grid
-  std::vector<std::vector<int>> m_grid;
+  // Space-filling-curve reordering
+  int m_reorderInterval;
+  int m_tickCount;
+  std::vector<Particle> m_reorderScratch;
+
+  bool m_reorderDue;
+
+  void reorderParticles();
+
+  // Verlet neighbour lists, one CSR row per particle. Rows are addressed
+  // through particle IDs and hold IDs, so they survive removal and
+  // reordering. Spawns are held back until the next rebuild so every live
+  // particle always has a row.
+  NeighborStrategy m_neighborStrategy;
+  float m_verletSkin;
+  float m_verletCutoff;          // Zombie size + skin at the last rebuild
+  int m_verletAge;               // Ticks since the last rebuild
+  int m_verletRebuilds;
+  bool m_verletDirty;            // Particles added outside update()
+  std::vector<int> m_verletOffsets;   // Row -> first entry, size rows + 1
+  std::vector<int> m_verletNeighbors; // Neighbour IDs
+  std::vector<int> m_verletRowOfId;   // ID -> row, -1 if none
+  std::vector<Map::Vector2> m_verletOrigin; // Row -> position at rebuild
+  std::vector<TypedParticle> m_pendingSpawns;
+
+  // Half-stencil pairwise separation, one accumulator per particle
+  std::vector<Map::Vector2> m_separation;
+
+  void accumulateCellPairSeparation();
+
+  bool verletNeedsRebuild() const;
+  void buildVerletLists();
+  int getVerletNeighbors(int pIndex, int *neighbors) const;
+
+  // Spatial Grid, counting-sorted: the particles of cell c are
+  // m_cellParticles[m_cellStart[c] .. m_cellStart[c + 1]).
+  std::vector<int> m_cellStart;
+  std::vector<int> m_cellParticles;
   int m_gridWidth;
   int m_gridHeight;
   int m_cellSize;
+  // Cells on each side a separation gather covers: enough for the largest
+  // archetype present at the current zombie size, set by updateGrid()
+  int m_gridReach;
+
+  bool m_gridCurrent; // Grid matches the current positions
 
   void updateGrid();
-  void getNeighbors(int pIndex, std::vector<int> &neighbors);
+  int getNeighbors(int pIndex, int *neighbors) const;
+
+  // Brings the grid up to date; false if there is none yet (before init)
+  bool prepareQueries();
+  // Query implementations; need a current grid, safe to run concurrently
+  int radiusQuery(float x, float y, float radius, int *out,
+                  int capacity) const;
+  int nearestQuery(float x, float y, int k, int *out) const;
+  int boxQuery(float minX, float minY, float maxX, float maxY, int *out,
+               int capacity) const;
+  int rayQuery(float x, float y, float dx, float dy, float maxDistance,
+               float *hitDistance) const;
+  void runQuery(SpatialQuery &query) const;
+
+  void renderDensity(const CrowdSnapshot &snapshot, const int *visible,
+                     int visibleCount);
+  // Indices of the zombies in tiles overlapping the render view
+  int cullToView(const CrowdSnapshot &snapshot, int *visible) const;
+
+  // Per-tick scratch (neighbour buffer, sort keys), reset at the start of
+  // update(). Persistent buffers above keep their capacity, so after warm-up
+  // a tick doesn't touch the heap. Render vertices get their own arena, as
+  // render() may run on a different thread from update().
+  FrameArena m_frameArena;
+  FrameArena m_renderArena;
+  // Threads for the parallel passes of a tick, started once in init()
+  int m_threadCount;
+  std::unique_ptr<WorkerPool> m_pool;
+
+  Metrics *m_metrics;
 };
@@ -0,0 +1,153 @@
+#include "SimulationThread.hpp"
+#include "Instrumentation.hpp"
+#include <chrono>
+
+SimulationThread::SimulationThread(Simulation *simulation)
+    : m_simulation(simulation), m_commandHead(0), m_commandTail(0),
+      m_back(0), m_front(1), m_ready(2), m_speed(1.0f), m_paused(false),
+      m_running(false), m_ticks(0), m_lastTickTime(0.0f) {}
+
+SimulationThread::~SimulationThread() { stop(); }
+
+void SimulationThread::start() {
+  if (m_running)
+    return;
+  // Something to draw before the first tick finishes
+  applyCommands();
+  publish();
+  m_running = true;
+  m_thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+  m_running = false;
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+bool SimulationThread::setSpeed(float speed) {
+  return push(CommandType::Speed, speed);
+}
+
+bool SimulationThread::setZombieSize(float size) {
+  return push(CommandType::ZombieSize, size);
+}
+
+bool SimulationThread::setPaused(bool paused) {
+  return push(CommandType::Pause, paused ? 1.0f : 0.0f);
+}
+
+bool SimulationThread::setNeighborInterval(int ticks) {
+  return push(CommandType::NeighborInterval, ticks);
+}
+
+bool SimulationThread::setJitter(bool enabled) {
+  return push(CommandType::Jitter, enabled ? 1.0f : 0.0f);
+}
+
+bool SimulationThread::setMaxSubsteps(int substeps) {
+  return push(CommandType::MaxSubsteps, substeps);
+}
+
+bool SimulationThread::setView(const ViewRect &view) {
+  return push(CommandType::View, 0.0f, view);
+}
+
+bool SimulationThread::setHeatmap(bool enabled) {
+  return push(CommandType::Heatmap, enabled ? 1.0f : 0.0f);
+}
+
+bool SimulationThread::push(CommandType type, float value,
+                            const ViewRect &view) {
+  uint32_t head = m_commandHead.load(std::memory_order_relaxed);
+  if (head - m_commandTail.load(std::memory_order_acquire) >=
+      kCommandRingSize)
+    return false;
+  m_commands[head % kCommandRingSize] = {type, value, view};
+  m_commandHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void SimulationThread::applyCommands() {
+  uint32_t tail = m_commandTail.load(std::memory_order_relaxed);
+  uint32_t head = m_commandHead.load(std::memory_order_acquire);
+  for (; tail != head; ++tail) {
+    const Command &command = m_commands[tail % kCommandRingSize];
+    switch (command.type) {
+    case CommandType::Speed:
+      m_speed = command.value;
+      break;
+    case CommandType::ZombieSize:
+      m_simulation->setZombieSize(command.value);
+      break;
+    case CommandType::Pause:
+      m_paused = command.value != 0.0f;
+      break;
+    case CommandType::NeighborInterval:
+      m_simulation->setNeighborInterval((int)command.value);
+      break;
+    case CommandType::Jitter:
+      m_simulation->setJitter(command.value != 0.0f);
+      break;
+    case CommandType::MaxSubsteps:
+      m_simulation->setMaxSubsteps((int)command.value);
+      break;
+    case CommandType::View:
+      m_simulation->setUpdateView(command.view);
+      break;
+    case CommandType::Heatmap:
+      m_simulation->setHeatmap(command.value != 0.0f);
+      break;
+    }
+  }
+  m_commandTail.store(tail, std::memory_order_release);
+}
+
+void SimulationThread::publish() {
+  m_simulation->writeSnapshot(m_snapshots[m_back]);
+  // The release half hands the finished slot over; the acquire half makes
+  // the slot we get back (last read by the renderer) safe to overwrite.
+  int previous = m_ready.exchange(m_back | kFresh, std::memory_order_acq_rel);
+  m_back = previous & kSlotMask;
+}
+
+const CrowdSnapshot &SimulationThread::acquire() {
+  if (m_ready.load(std::memory_order_relaxed) & kFresh) {
+    int previous = m_ready.exchange(m_front, std::memory_order_acq_rel);
+    m_front = previous & kSlotMask;
+  }
+  return m_snapshots[m_front];
+}
+
+void SimulationThread::run() {
+  using Clock = std::chrono::steady_clock;
+  const float dt = 1.0f / 60.0f;
+  const auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<float>(dt));
+
+  auto next = Clock::now();
+  while (m_running) {
+    uint32_t pending = m_commandHead.load(std::memory_order_acquire) -
+                       m_commandTail.load(std::memory_order_relaxed);
+    applyCommands();
+
+    if (!m_paused) {
+      double start = Instrumentation::now();
+      m_simulation->update(dt * m_speed);
+      m_lastTickTime.store(Instrumentation::now() - start,
+                           std::memory_order_relaxed);
+      m_ticks.fetch_add(1, std::memory_order_relaxed);
+      publish();
+    } else if (pending > 0) {
+      publish(); // e.g. a new zombie size while paused
+    }
+
+    // Fixed rate; after falling behind (a stall, or ticks slower than the
+    // period) carry on from now instead of racing to catch up.
+    next += period;
+    auto now = Clock::now();
+    if (next < now - period * 4)
+      next = now;
+    std::this_thread::sleep_until(next);
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Simulation.hpp"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Runs a Simulation on its own thread at a fixed tick rate, so drawing a big
+// crowd no longer holds up the next tick and a slow tick no longer holds up
+// the frame.
+//
+// After every tick the simulation thread writes a CrowdSnapshot into a
+// triple buffer: one slot it writes, one the render thread reads, and one
+// holding the latest complete snapshot. Handing over is a single atomic
+// exchange on either side, so neither thread ever waits for the other and
+// the renderer always gets the newest finished tick.
+//
+// UI input reaches the simulation as commands on a single-producer/
+// single-consumer ring (the UI thread pushes, the simulation thread drains
+// before each tick); nothing the UI touches is shared with the running
+// tick.
+class SimulationThread {
+public:
+  explicit SimulationThread(Simulation *simulation);
+  ~SimulationThread();
+
+  // The simulation must not be touched by anyone else between start() and
+  // stop(). start() publishes an initial snapshot before the thread runs.
+  void start();
+  void stop();
+
+  // UI thread. Returns false if the ring is full and the command was lost.
+  bool setSpeed(float speed);
+  bool setZombieSize(float size);
+  bool setPaused(bool paused);
+  // Tick quality knobs, see Simulation::setNeighborInterval and friends
+  bool setNeighborInterval(int ticks);
+  bool setJitter(bool enabled);
+  bool setMaxSubsteps(int substeps);
+  // What the camera shows, for Simulation::setUpdateView
+  bool setView(const ViewRect &view);
+  bool setHeatmap(bool enabled);
+
+  // Render thread. Latest complete snapshot; stays valid and unchanged until
+  // the next call.
+  const CrowdSnapshot &acquire();
+
+  int getTickCount() const { return m_ticks.load(std::memory_order_relaxed); }
+  // Duration of the latest Simulation::update, ms
+  float getLastTickTime() const {
+    return m_lastTickTime.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum class CommandType {
+    Speed,
+    ZombieSize,
+    Pause,
+    NeighborInterval,
+    Jitter,
+    MaxSubsteps,
+    View,
+    Heatmap
+  };
+  struct Command {
+    CommandType type;
+    float value;
+    ViewRect view; // View only
+  };
+
+  static const int kCommandRingSize = 64; // Power of two
+  static const int kFresh = 4;            // Set in m_ready once published
+  static const int kSlotMask = 3;
+
+  Simulation *m_simulation;
+
+  Command m_commands[kCommandRingSize];
+  alignas(64) std::atomic<uint32_t> m_commandHead; // Next slot to write
+  alignas(64) std::atomic<uint32_t> m_commandTail; // Next slot to read
+
+  CrowdSnapshot m_snapshots[3];
+  int m_back;  // Simulation thread's slot
+  int m_front; // Render thread's slot
+  alignas(64) std::atomic<int> m_ready; // Latest complete slot | kFresh
+
+  // Simulation thread only
+  float m_speed;
+  bool m_paused;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::atomic<int> m_ticks;
+  std::atomic<float> m_lastTickTime;
+
+  bool push(CommandType type, float value, const ViewRect &view = {});
+  void applyCommands();
+  void publish();
+  void run();
+};
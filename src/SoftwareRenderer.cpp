@@ -0,0 +1,309 @@
+#include "SoftwareRenderer.hpp"
+#include "Parallel.hpp"
+#include <SDL.h>
+#include <SDL_image.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+static const int kTileSize = 64;
+
+// Pixels are SDL_PIXELFORMAT_RGBA32, i.e. R, G, B, A in memory order, so
+// where each channel sits in a uint32_t depends on the host byte order.
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+static const int kChannelShift[4] = {24, 16, 8, 0};
+#else
+static const int kChannelShift[4] = {0, 8, 16, 24};
+#endif
+
+static inline int channel(uint32_t pixel, int c) {
+  return (pixel >> kChannelShift[c]) & 0xff;
+}
+
+static inline uint32_t packPixel(int r, int g, int b, int a) {
+  return (uint32_t)r << kChannelShift[0] | (uint32_t)g << kChannelShift[1] |
+         (uint32_t)b << kChannelShift[2] | (uint32_t)a << kChannelShift[3];
+}
+
+// Premultiplied "over": dst = src + dst * (1 - src alpha). Two channels at
+// a time in alternating bytes; the weight maps alpha 0..255 onto 256..0 so
+// the >> 8 is exact at both ends.
+static inline void blendOver(uint32_t &dst, uint32_t src) {
+  int alpha = channel(src, 3);
+  uint32_t weight = 256 - alpha - (alpha >> 7);
+  uint32_t evens = ((dst & 0x00ff00ff) * weight >> 8) & 0x00ff00ff;
+  uint32_t odds = ((dst >> 8 & 0x00ff00ff) * weight) & 0xff00ff00;
+  dst = src + (evens | odds);
+}
+
+// Decode any image into a tightly packed RGBA32 surface
+static SDL_Surface *loadRGBA(const char *file) {
+  SDL_Surface *loaded = IMG_Load(file);
+  if (!loaded) {
+    printf("Failed to load %s: %s\n", file, IMG_GetError());
+    return nullptr;
+  }
+  SDL_Surface *surface =
+      SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+  SDL_FreeSurface(loaded);
+  if (!surface)
+    printf("Failed to convert %s: %s\n", file, SDL_GetError());
+  return surface;
+}
+
+SoftwareRenderer::SoftwareRenderer(const Map *map, int width, int height)
+    : m_map(map), m_width(width), m_height(height),
+      m_pixels(width * height), m_background(width * height, 0) {
+  // Fit the whole map, centred, keeping its aspect ratio
+  int mapW = m_map->getWidth();
+  int mapH = m_map->getHeight();
+  m_scale = std::min((float)width / mapW, (float)height / mapH);
+  m_offsetX = (width - mapW * m_scale) * 0.5f;
+  m_offsetY = (height - mapH * m_scale) * 0.5f;
+
+  m_tilesX = (width + kTileSize - 1) / kTileSize;
+  m_tilesY = (height + kTileSize - 1) / kTileSize;
+  m_binStart.resize(m_tilesX * m_tilesY + 1);
+}
+
+bool SoftwareRenderer::load(const char *bgFile, const char *spriteFile) {
+  SDL_Surface *bg = loadRGBA(bgFile);
+  if (!bg)
+    return false;
+
+  // The background is stretched over the map like in Map::render. It never
+  // changes, so it is resampled (bilinear) to frame pixels once, here.
+  int mapW = m_map->getWidth();
+  int mapH = m_map->getHeight();
+  SDL_LockSurface(bg);
+  for (int py = 0; py < m_height; ++py) {
+    for (int px = 0; px < m_width; ++px) {
+      float wx = (px + 0.5f - m_offsetX) / m_scale;
+      float wy = (py + 0.5f - m_offsetY) / m_scale;
+      if (wx < 0 || wy < 0 || wx >= mapW || wy >= mapH) {
+        m_background[py * m_width + px] = packPixel(0, 0, 0, 255);
+        continue;
+      }
+
+      float fx = std::max(0.0f, wx / mapW * bg->w - 0.5f);
+      float fy = std::max(0.0f, wy / mapH * bg->h - 0.5f);
+      int x0 = std::min((int)fx, bg->w - 1);
+      int y0 = std::min((int)fy, bg->h - 1);
+      int x1 = std::min(x0 + 1, bg->w - 1);
+      int y1 = std::min(y0 + 1, bg->h - 1);
+      float tx = fx - x0;
+      float ty = fy - y0;
+
+      auto texel = [&](int x, int y) {
+        return *(const uint32_t *)((const uint8_t *)bg->pixels +
+                                   y * bg->pitch + x * 4);
+      };
+      uint32_t a = texel(x0, y0), b = texel(x1, y0);
+      uint32_t c = texel(x0, y1), d = texel(x1, y1);
+      int rgb[3];
+      for (int k = 0; k < 3; ++k) {
+        float top = channel(a, k) + (channel(b, k) - channel(a, k)) * tx;
+        float bottom = channel(c, k) + (channel(d, k) - channel(c, k)) * tx;
+        rgb[k] = (int)(top + (bottom - top) * ty + 0.5f);
+      }
+      m_background[py * m_width + px] = packPixel(rgb[0], rgb[1], rgb[2], 255);
+    }
+  }
+  SDL_UnlockSurface(bg);
+  SDL_FreeSurface(bg);
+
+  SDL_Surface *sprite = loadRGBA(spriteFile);
+  if (!sprite)
+    return false;
+
+  // Zombies end up a few pixels wide, so sampling the full-size sprite
+  // would alias badly. Keep a chain of box-filtered halvings and splat from
+  // the one closest to the on-screen size. Premultiplying first keeps the
+  // transparent border from bleeding dark fringes into the smaller levels.
+  SDL_LockSurface(sprite);
+  SpriteLevel base;
+  base.size = std::min(sprite->w, sprite->h);
+  base.texels.resize(base.size * base.size);
+  for (int y = 0; y < base.size; ++y) {
+    for (int x = 0; x < base.size; ++x) {
+      uint32_t p = *(const uint32_t *)((const uint8_t *)sprite->pixels +
+                                       y * sprite->pitch + x * 4);
+      int alpha = channel(p, 3);
+      base.texels[y * base.size + x] =
+          packPixel(channel(p, 0) * alpha / 255, channel(p, 1) * alpha / 255,
+                    channel(p, 2) * alpha / 255, alpha);
+    }
+  }
+  SDL_UnlockSurface(sprite);
+  SDL_FreeSurface(sprite);
+
+  m_sprite.clear();
+  m_sprite.push_back(std::move(base));
+  while (m_sprite.back().size > 1) {
+    const SpriteLevel &prev = m_sprite.back();
+    SpriteLevel level;
+    level.size = prev.size / 2;
+    level.texels.resize(level.size * level.size);
+    for (int y = 0; y < level.size; ++y) {
+      for (int x = 0; x < level.size; ++x) {
+        int sum[4] = {0, 0, 0, 0};
+        for (int k = 0; k < 4; ++k) {
+          uint32_t p =
+              prev.texels[(y * 2 + k / 2) * prev.size + x * 2 + k % 2];
+          for (int c = 0; c < 4; ++c) {
+            sum[c] += channel(p, c);
+          }
+        }
+        level.texels[y * level.size + x] =
+            packPixel((sum[0] + 2) / 4, (sum[1] + 2) / 4, (sum[2] + 2) / 4,
+                      (sum[3] + 2) / 4);
+      }
+    }
+    m_sprite.push_back(std::move(level));
+  }
+  return true;
+}
+
+void SoftwareRenderer::render(const std::vector<Particle> &particles,
+                              float zombieSize) {
+  if (m_sprite.empty())
+    return;
+
+  int n = particles.size();
+  int tileCount = m_tilesX * m_tilesY;
+  float halfSize = zombieSize * m_scale * 0.5f;
+
+  // Heading as cos/sin straight from the velocity, as in Simulation::render
+  m_splats.resize(n);
+  for (int i = 0; i < n; ++i) {
+    const Particle &p = particles[i];
+    Splat &splat = m_splats[i];
+    float vx = p.vx;
+    float vy = p.vy;
+    float speed = std::sqrt(vx * vx + vy * vy);
+    splat.x = p.x * m_scale + m_offsetX;
+    splat.y = p.y * m_scale + m_offsetY;
+    splat.c = speed > 0 ? vx / speed : 1.0f;
+    splat.s = speed > 0 ? vy / speed : 0.0f;
+  }
+
+  // Tiles touched by the axis-aligned bounds of a rotated sprite; false if
+  // it is entirely off-screen.
+  auto tileRange = [&](const Splat &splat, int &tx0, int &ty0, int &tx1,
+                       int &ty1) {
+    float extent = halfSize * (std::fabs(splat.c) + std::fabs(splat.s));
+    tx0 = std::max(0, (int)std::floor((splat.x - extent) / kTileSize));
+    ty0 = std::max(0, (int)std::floor((splat.y - extent) / kTileSize));
+    tx1 = std::min(m_tilesX - 1,
+                   (int)std::floor((splat.x + extent) / kTileSize));
+    ty1 = std::min(m_tilesY - 1,
+                   (int)std::floor((splat.y + extent) / kTileSize));
+    return tx0 <= tx1 && ty0 <= ty1;
+  };
+
+  // Bin by tile: count, inclusive prefix sum, then scatter backwards so each
+  // bin ends up in storage order (later zombies drawn on top, as on the GPU).
+  // Bins hold copies rather than indices so a tile reads its splats
+  // sequentially however scattered the particles are in storage.
+  std::fill(m_binStart.begin(), m_binStart.end(), 0);
+  for (int i = 0; i < n; ++i) {
+    int tx0, ty0, tx1, ty1;
+    if (!tileRange(m_splats[i], tx0, ty0, tx1, ty1))
+      continue;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+      for (int tx = tx0; tx <= tx1; ++tx) {
+        m_binStart[ty * m_tilesX + tx]++;
+      }
+    }
+  }
+  for (int t = 1; t <= tileCount; ++t) {
+    m_binStart[t] += m_binStart[t - 1];
+  }
+  m_binSplats.resize(m_binStart[tileCount]);
+  for (int i = n - 1; i >= 0; --i) {
+    int tx0, ty0, tx1, ty1;
+    if (!tileRange(m_splats[i], tx0, ty0, tx1, ty1))
+      continue;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+      for (int tx = tx0; tx <= tx1; ++tx) {
+        m_binSplats[--m_binStart[ty * m_tilesX + tx]] = m_splats[i];
+      }
+    }
+  }
+
+  // Smallest sprite level that still has a texel per screen pixel
+  int levelIndex = 0;
+  while (levelIndex + 1 < (int)m_sprite.size() &&
+         m_sprite[levelIndex + 1].size >= halfSize * 2.0f) {
+    levelIndex++;
+  }
+  const SpriteLevel &level = m_sprite[levelIndex];
+
+  std::atomic<int> nextTile(0);
+  runParallel(parallelThreadCount(), [&](int) {
+    int tile;
+    while ((tile = nextTile.fetch_add(1)) < tileCount) {
+      renderTile(tile, halfSize, level);
+    }
+  });
+}
+
+void SoftwareRenderer::renderTile(int tile, float halfSize,
+                                  const SpriteLevel &level) {
+  int x0 = (tile % m_tilesX) * kTileSize;
+  int y0 = (tile / m_tilesX) * kTileSize;
+  int x1 = std::min(x0 + kTileSize, m_width);
+  int y1 = std::min(y0 + kTileSize, m_height);
+
+  for (int y = y0; y < y1; ++y) {
+    std::memcpy(&m_pixels[y * m_width + x0], &m_background[y * m_width + x0],
+                (x1 - x0) * sizeof(uint32_t));
+  }
+
+  // Inverse-map each covered pixel centre into the sprite (nearest texel)
+  float texelsPerPixel = level.size / (halfSize * 2.0f);
+  for (int k = m_binStart[tile]; k < m_binStart[tile + 1]; ++k) {
+    const Splat &splat = m_binSplats[k];
+    float extent = halfSize * (std::fabs(splat.c) + std::fabs(splat.s));
+    int px0 = std::max(x0, (int)std::floor(splat.x - extent));
+    int py0 = std::max(y0, (int)std::floor(splat.y - extent));
+    int px1 = std::min(x1 - 1, (int)std::floor(splat.x + extent));
+    int py1 = std::min(y1 - 1, (int)std::floor(splat.y + extent));
+
+    for (int py = py0; py <= py1; ++py) {
+      float dy = py + 0.5f - splat.y;
+      uint32_t *row = &m_pixels[py * m_width];
+      for (int px = px0; px <= px1; ++px) {
+        float dx = px + 0.5f - splat.x;
+        float u = (dx * splat.c + dy * splat.s + halfSize) * texelsPerPixel;
+        float v = (dy * splat.c - dx * splat.s + halfSize) * texelsPerPixel;
+        if (u < 0 || v < 0 || u >= level.size || v >= level.size)
+          continue;
+        uint32_t texel = level.texels[(int)v * level.size + (int)u];
+        if (channel(texel, 3) != 0)
+          blendOver(row[px], texel);
+      }
+    }
+  }
+}
+
+bool SoftwareRenderer::writePNG(const char *file) const {
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+      (void *)m_pixels.data(), m_width, m_height, 32, m_width * 4,
+      SDL_PIXELFORMAT_RGBA32);
+  if (!surface) {
+    printf("Failed to wrap frame: %s\n", SDL_GetError());
+    return false;
+  }
+  bool ok = IMG_SavePNG(surface, file) == 0;
+  if (!ok)
+    printf("Failed to write %s: %s\n", file, IMG_GetError());
+  SDL_FreeSurface(surface);
+  return ok;
+}
+
+bool SoftwareRenderer::writeRaw(FILE *out) const {
+  return fwrite(m_pixels.data(), sizeof(uint32_t), m_pixels.size(), out) ==
+         m_pixels.size();
+}
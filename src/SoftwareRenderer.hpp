@@ -0,0 +1,65 @@
+#pragma once
+#include "Map.hpp"
+#include "Simulation.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// CPU renderer for offline frame capture on machines without a GPU or
+// display. Composites the map background and splats rotated zombie sprites
+// into an RGBA framebuffer, fitting the whole map into the frame.
+//
+// The frame is cut into square tiles. Zombies are binned by the tiles their
+// sprite touches, then worker threads pull tiles and each one copies its
+// patch of the (pre-scaled) background and splats its bin in storage order,
+// so no two threads ever write the same pixel.
+class SoftwareRenderer {
+public:
+  SoftwareRenderer(const Map *map, int width, int height);
+
+  bool load(const char *bgFile, const char *spriteFile);
+  void render(const std::vector<Particle> &particles, float zombieSize);
+
+  // Frames are RGBA, 8 bits per channel, top row first. Raw frames are what
+  // e.g. `ffmpeg -f rawvideo -pix_fmt rgba -s WxH -i -` expects.
+  bool writePNG(const char *file) const;
+  bool writeRaw(FILE *out) const;
+
+  int getWidth() const { return m_width; }
+  int getHeight() const { return m_height; }
+  const std::vector<uint32_t> &getPixels() const { return m_pixels; }
+
+private:
+  // A zombie in screen space: centre and heading
+  struct Splat {
+    float x, y;
+    float c, s;
+  };
+
+  // Premultiplied RGBA, one level per halving of the sprite size
+  struct SpriteLevel {
+    int size;
+    std::vector<uint32_t> texels;
+  };
+
+  const Map *m_map;
+  int m_width;
+  int m_height;
+  std::vector<uint32_t> m_pixels;
+  std::vector<uint32_t> m_background; // Scaled to the frame once at load
+
+  // World -> screen: screen = world * m_scale + offset
+  float m_scale;
+  float m_offsetX;
+  float m_offsetY;
+
+  std::vector<SpriteLevel> m_sprite;
+
+  int m_tilesX;
+  int m_tilesY;
+  std::vector<Splat> m_splats;
+  std::vector<int> m_binStart; // Tile -> first entry in m_binSplats
+  std::vector<Splat> m_binSplats;
+
+  void renderTile(int tile, float halfSize, const SpriteLevel &level);
+};
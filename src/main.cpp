@@ -1,9 +1,482 @@
+#include "DistributedSimulation.hpp"
+#include "Ensemble.hpp"
 #include "Game.hpp"
+#include "Instrumentation.hpp"
+#include "Metrics.hpp"
+#include "SoftwareRenderer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 Game *game = nullptr;
 
+struct HeadlessOptions {
+  int workers = 0;
+  int ticks = 600;
+  int particleCount = 5000;
+  int reorder = 32;
+  NeighborStrategy strategy = NeighborStrategy::Grid;
+  float verletSkin = -1.0f; // < 0 keeps the simulation's default
+  float runners = 0.0f, brutes = 0.0f, crawlers = 0.0f;
+  int congestion = 0;
+  bool viewSet = false;
+  ViewRect view = {0, 0, 0, 0};
+  int allocWarmup = -1;
+  int losQueries = 0;
+  struct GoalDisc {
+    float x, y, radius;
+  };
+  std::vector<GoalDisc> goals; // Replace the mask's goals
+
+  // Ensemble of independent runs
+  int ensembleRuns = 0;
+  int ensembleThreads = 0;
+  unsigned int seed = 1;
+  const char *metricsEndpoint = nullptr;
+  double frameBudget = 1000.0 / 60.0; // Windowed game only, ms
+
+  // Frame capture
+  const char *framesDir = nullptr;
+  const char *encodeCommand = nullptr;
+  int captureWidth = 1920;
+  int captureHeight = 1080;
+  int captureEvery = 1;
+
+  // Density grid dumps
+  const char *densityDir = nullptr;
+  int densityEvery = 60;
+};
+
+// Renders the current particles and hands the frame to the PNG sequence
+// and/or the encoder pipe. Returns false once output has failed.
+static bool captureFrame(SoftwareRenderer &renderer, FILE *encoder,
+                         const HeadlessOptions &options,
+                         const std::vector<Particle> &particles, int frame) {
+  renderer.render(particles, 1.0f);
+  if (options.framesDir) {
+    char file[1024];
+    snprintf(file, sizeof(file), "%s/frame_%05d.png", options.framesDir,
+             frame);
+    if (!renderer.writePNG(file))
+      return false;
+  }
+  if (encoder && !renderer.writeRaw(encoder)) {
+    printf("Encoder stopped accepting frames\n");
+    return false;
+  }
+  return true;
+}
+
+// Writes the heatmap grid of a snapshot as CSV, one row per occupied cell,
+// for offline analysis. Cell coordinates are in grid cells; multiply by the
+// cell size from the header comment for map cells.
+static bool dumpDensity(const CrowdSnapshot &snapshot, const char *file) {
+  FILE *out = fopen(file, "w");
+  if (!out) {
+    printf("Failed to write %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  fprintf(out, "# tick %d, %dx%d grid cells of %d map cells\n", snapshot.tick,
+          snapshot.gridWidth, snapshot.gridHeight, snapshot.cellSize);
+  fprintf(out, "cell_x,cell_y,count,mean_speed\n");
+  for (int y = 0; y < snapshot.gridHeight; ++y) {
+    for (int x = 0; x < snapshot.gridWidth; ++x) {
+      int c = y * snapshot.gridWidth + x;
+      int count = snapshot.cellCounts[c];
+      if (count > 0)
+        fprintf(out, "%d,%d,%d,%.3f\n", x, y, count,
+                snapshot.cellSpeeds[c] / count);
+    }
+  }
+  bool ok = !ferror(out);
+  return fclose(out) == 0 && ok;
+}
+
+// Times line-of-sight queries between random open cells, through the
+// occupancy pyramid and with the plain cell-by-cell walk. Both must give
+// the same answer for every query; returns false if any differ.
+static bool runLosBenchmark(const Map &map, int queries) {
+  const OccupancyPyramid &occupancy = map.getOccupancy();
+  int w = map.getWidth();
+  int h = map.getHeight();
+  std::vector<float> points;
+  points.reserve(queries * 4);
+  while ((int)points.size() < queries * 4) {
+    float x = (std::rand() % (w * 16)) / 16.0f;
+    float y = (std::rand() % (h * 16)) / 16.0f;
+    if (!occupancy.isBlocked((int)x, (int)y)) {
+      points.push_back(x);
+      points.push_back(y);
+    }
+  }
+
+  std::vector<unsigned char> answers[2];
+  int visible[2] = {0, 0};
+  for (int pass = 0; pass < 2; ++pass) {
+    int topLevel = pass == 0 ? OccupancyPyramid::kLevels - 1 : 0;
+    answers[pass].resize(queries);
+    double start = Instrumentation::now();
+    for (int q = 0; q < queries; ++q) {
+      const float *p = &points[q * 4];
+      answers[pass][q] =
+          occupancy.lineOfSight(p[0], p[1], p[2], p[3], topLevel);
+      visible[pass] += answers[pass][q];
+    }
+    double elapsed = Instrumentation::now() - start;
+    printf("%s: %d queries in %.1f ms, %.2f M/s, %d clear\n",
+           pass == 0 ? "pyramid" : "cell walk", queries, elapsed,
+           queries / (elapsed * 1000.0), visible[pass]);
+  }
+
+  int disagree = 0;
+  for (int q = 0; q < queries; ++q) {
+    if (answers[0][q] == answers[1][q])
+      continue;
+    if (disagree++ == 0) {
+      const float *p = &points[q * 4];
+      printf("first disagreement: %.4f,%.4f -> %.4f,%.4f\n", p[0], p[1],
+             p[2], p[3]);
+    }
+  }
+  if (disagree > 0)
+    printf("pyramid and cell walk disagree on %d queries\n", disagree);
+  return disagree == 0;
+}
+
+// Headless run without a window, used to compare the single-process
+// simulation with the distributed one on a single host:
+//   zombie_flood --workers N [--ticks T] [--particles P] [--reorder K]
+//                [--neighbors S] [--verlet-skin M] [--mix R,B,C]
+//                [--congestion C]
+//                [--alloc-check W]
+//                [--frames DIR] [--encode CMD] [--capture-size WxH]
+//                [--capture-every E] [--metrics ENDPOINT]
+//                [--los-bench Q] [--view X,Y,W,H]
+//                [--density-dump DIR] [--density-every E]
+//                [--goal X,Y,R ...]
+//                [--ensemble R] [--ensemble-threads T] [--seed S]
+// Every run is seeded from S (default 1), so repeating a command repeats
+// the run exactly, except with --congestion, whose fields land on whichever
+// tick their background build finishes.
+// N = 1 runs the plain in-process Simulation, with particle storage
+// reordered every K ticks (0 = never) and neighbour strategy S ("grid",
+// "verlet" or "cellpairs") so layouts and strategies can be compared. It
+// reports the mean tick time; build with ZOMBIE_COMPACT_PARTICLES to compare
+// the compact particle layout against the float one. --mix gives the
+// fractions of runners, brutes and crawlers; the rest are walkers.
+// N > 1 splits the map into N strips, one worker process each, with the
+// same crowd options; --congestion, --alloc-check and --density-dump need
+// the whole crowd in one process and are rejected.
+//
+// --verlet-skin sets the Verlet list margin to M cells (default 3), and the
+// run reports how often the lists were rebuilt. Over 1800 ticks of walkers,
+// 3 rebuilds about 200 times and ticks about 25% faster than the grid; 1
+// rebuilds about 590 times and is no faster. With runners and brutes mixed
+// in the lists are longer and Verlet only matches the grid.
+// --congestion rebuilds a crowd-aware flow field every C ticks; compare the
+// reported sink rate against a run without it.
+//
+// With --alloc-check, every tick after the first W must run without a heap
+// allocation; the run fails otherwise. Needs a ZOMBIE_COUNT_ALLOCATIONS
+// build.
+//
+// Every E ticks a frame can be rendered on the CPU (1920x1080 by default)
+// and written as DIR/frame_NNNNN.png, and/or piped as raw RGBA to CMD, e.g.
+//   --encode "ffmpeg -f rawvideo -pix_fmt rgba -s 1920x1080 -r 60 -i - out.mp4"
+//
+// --density-dump writes the crowd heatmap grid (zombies and mean speed per
+// grid cell) every E ticks (default 60) as DIR/density_NNNNN.csv.
+//
+// --view stands in for a camera showing W x H cells from (X, Y): zombies
+// off it and far from any goal tick at reduced rate (update LOD).
+//
+// Each --goal makes the cells within R of (X, Y) a goal, in place of those
+// marked green in the mask (or the default one at the centre). The
+// single-process run reports what each goal sank.
+//
+// --ensemble runs R independent simulations of the same (once built) map
+// with seeds S, S + 1, ... on T threads (default: one per hardware thread),
+// using the crowd options above, and prints a report instead of simulating
+// once.
+//
+// --los-bench times Q line-of-sight queries between random open cells,
+// with and without the occupancy pyramid, instead of simulating, and exits
+// with 1 if the two disagree on any query.
+//
+// --metrics (also accepted without --workers, for the windowed game) serves
+// Prometheus metrics on a localhost port, or on a Unix socket when ENDPOINT
+// is a path. Only the single-process simulation reports.
+static int runHeadless(const HeadlessOptions &options, Metrics *metrics) {
+  Map map(800, 600); // Resized by load, as in Game::init
+  if (!map.loadHeadless("assets/map.jpg", "assets/mask.png")) {
+    std::cerr << "Failed to load map assets!" << std::endl;
+    return -1;
+  }
+
+  for (const auto &goal : options.goals) {
+    if (map.addGoal(goal.x, goal.y, goal.radius) < 0)
+      printf("Goal at %.1f,%.1f covers no cell, ignored\n", goal.x, goal.y);
+  }
+  printf("%d goals\n", map.getGoalCount());
+
+  // Anything still drawing from std::rand() (the LOS benchmark's points)
+  // follows --seed too; the map reseeds it with the time on construction
+  std::srand(options.seed);
+
+  if (options.losQueries > 0) {
+    return runLosBenchmark(map, options.losQueries) ? 0 : 1;
+  }
+
+  if (options.ensembleRuns > 0) {
+    std::vector<EnsembleRun> runs(options.ensembleRuns);
+    for (int i = 0; i < options.ensembleRuns; ++i) {
+      EnsembleRun &run = runs[i];
+      run.seed = options.seed + i;
+      run.ticks = options.ticks;
+      run.particleCount = options.particleCount;
+      run.runners = options.runners;
+      run.brutes = options.brutes;
+      run.crawlers = options.crawlers;
+      run.congestion = options.congestion;
+      run.strategy = options.strategy;
+    }
+    Ensemble ensemble(&map, options.ensembleThreads);
+    printf("ensemble of %d runs on %d threads, %d NUMA nodes\n",
+           options.ensembleRuns, ensemble.getThreadCount(),
+           ensemble.getNodeCount());
+    double start = Instrumentation::now();
+    std::vector<EnsembleResult> results = ensemble.run(runs);
+    double elapsed = Instrumentation::now() - start;
+    Ensemble::printReport(results, stdout);
+    printf("ensemble took %.1f ms\n", elapsed);
+    return 0;
+  }
+
+  const float dt = 1.0f / 60.0f;
+  int ticks = options.ticks;
+
+  bool capturing = options.framesDir || options.encodeCommand;
+  SoftwareRenderer renderer(&map, options.captureWidth, options.captureHeight);
+  FILE *encoder = nullptr;
+  if (capturing) {
+    if (!renderer.load("assets/map.jpg", "assets/zombie1.png"))
+      return -1;
+    if (options.encodeCommand) {
+      // A dead encoder should surface as a failed write
+      signal(SIGPIPE, SIG_IGN);
+      encoder = popen(options.encodeCommand, "w");
+      if (!encoder) {
+        printf("Failed to start encoder: %s\n", strerror(errno));
+        return -1;
+      }
+    }
+  }
+  int frame = 0;
+  double captureTime = 0.0;
+
+  int result = 0;
+  if (options.workers <= 1) {
+    Simulation sim(&map);
+    sim.setSeed(options.seed);
+    sim.setReorderInterval(options.reorder);
+    sim.setNeighborStrategy(options.strategy);
+    if (options.verletSkin >= 0.0f)
+      sim.setVerletSkin(options.verletSkin);
+    sim.setMetrics(metrics);
+    sim.setTypeMix(options.runners, options.brutes, options.crawlers);
+    sim.setCongestionInterval(options.congestion);
+    if (options.viewSet)
+      sim.setUpdateView(options.view);
+    sim.setHeatmap(options.densityDir != nullptr);
+    CrowdSnapshot heatmap;
+    bool dumping = options.densityDir != nullptr;
+    sim.init(options.particleCount);
+
+    int allocWarmup = options.allocWarmup;
+    if (allocWarmup >= 0 && Instrumentation::allocationCount() < 0) {
+      printf("--alloc-check needs a ZOMBIE_COUNT_ALLOCATIONS build\n");
+      return -1;
+    }
+
+    double updateTime = 0.0;
+    long long allocations = 0;
+    int allocatingTicks = 0;
+    for (int t = 1; t <= ticks; ++t) {
+      long long allocationsBefore = Instrumentation::allocationCount();
+      double start = Instrumentation::now();
+      sim.update(dt);
+      updateTime += Instrumentation::now() - start;
+      long long tickAllocations =
+          Instrumentation::allocationCount() - allocationsBefore;
+      if (allocWarmup >= 0 && t > allocWarmup && tickAllocations > 0) {
+        allocations += tickAllocations;
+        allocatingTicks++;
+        printf("tick %d: %lld heap allocations\n", t, tickAllocations);
+      }
+      if (capturing && t % options.captureEvery == 0) {
+        start = Instrumentation::now();
+        capturing = captureFrame(renderer, encoder, options,
+                                 sim.getParticles(), frame++);
+        captureTime += Instrumentation::now() - start;
+      }
+      if (dumping && t % options.densityEvery == 0) {
+        char file[1024];
+        snprintf(file, sizeof(file), "%s/density_%05d.csv", options.densityDir,
+                 t);
+        sim.writeSnapshot(heatmap);
+        dumping = dumpDensity(heatmap, file);
+      }
+      if (t % 60 == 0 || t == ticks)
+        printf("tick %d score %d particles %d\n", t, sim.getScore(),
+               sim.getParticleCount());
+    }
+    printf("particle layout %d bytes, mean update %.3f ms\n",
+           (int)sizeof(Particle), updateTime / ticks);
+    printf("sunk %.1f per simulated minute\n",
+           sim.getScore() / (ticks * dt / 60.0f));
+    for (int g = 0; g < map.getGoalCount(); ++g) {
+      const Map::Goal &goal = map.getGoal(g);
+      printf("goal %d at %.1f,%.1f (%d cells): %d sunk\n", g, goal.x, goal.y,
+             goal.cells, sim.getGoalScore(g));
+    }
+    if (options.congestion > 0)
+      printf("congestion field builds %d\n", sim.getCongestionBuildCount());
+    if (options.strategy == NeighborStrategy::Verlet)
+      printf("verlet rebuilds %d\n", sim.getVerletRebuildCount());
+    if (allocWarmup >= 0) {
+      printf("heap allocations after %d warm-up ticks: %lld in %d ticks\n",
+             allocWarmup, allocations, allocatingTicks);
+      if (allocations > 0)
+        result = 1;
+    }
+  } else {
+    // These need the whole crowd in one process
+    if (options.congestion > 0 || options.allocWarmup >= 0 ||
+        options.densityDir) {
+      printf("--congestion, --alloc-check and --density-dump need --workers "
+             "1\n");
+      return -1;
+    }
+    DistributedSimulation sim(&map, options.workers);
+    sim.setSeed(options.seed);
+    sim.setReorderInterval(options.reorder);
+    sim.setNeighborStrategy(options.strategy);
+    if (options.verletSkin >= 0.0f)
+      sim.setVerletSkin(options.verletSkin);
+    sim.setTypeMix(options.runners, options.brutes, options.crawlers);
+    if (options.viewSet)
+      sim.setUpdateView(options.view);
+    if (!sim.init(options.particleCount))
+      return -1;
+    for (int t = 1; t <= ticks; ++t) {
+      bool captureTick = capturing && t % options.captureEvery == 0;
+      if (captureTick)
+        sim.requestSnapshot();
+      sim.update(dt);
+      if (captureTick) {
+        double start = Instrumentation::now();
+        capturing = captureFrame(renderer, encoder, options, sim.getSnapshot(),
+                                 frame++);
+        captureTime += Instrumentation::now() - start;
+      }
+      if (t % 60 == 0 || t == ticks)
+        printf("tick %d score %d particles %d\n", t, sim.getScore(),
+               sim.getParticleCount());
+    }
+    sim.shutdown();
+  }
+
+  if (frame > 0)
+    printf("captured %d frames at %dx%d, mean %.3f ms per frame\n", frame,
+           options.captureWidth, options.captureHeight, captureTime / frame);
+  if (encoder)
+    pclose(encoder);
+  return result;
+}
+
 int main(int argc, char *argv[]) {
+  HeadlessOptions options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--workers") == 0) {
+      options.workers = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--ticks") == 0) {
+      options.ticks = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--particles") == 0) {
+      options.particleCount = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--reorder") == 0) {
+      options.reorder = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--neighbors") == 0) {
+      if (std::strcmp(argv[i + 1], "verlet") == 0)
+        options.strategy = NeighborStrategy::Verlet;
+      else if (std::strcmp(argv[i + 1], "cellpairs") == 0)
+        options.strategy = NeighborStrategy::CellPairs;
+      else
+        options.strategy = NeighborStrategy::Grid;
+    } else if (std::strcmp(argv[i], "--verlet-skin") == 0) {
+      options.verletSkin = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--mix") == 0) {
+      sscanf(argv[i + 1], "%f,%f,%f", &options.runners, &options.brutes,
+             &options.crawlers);
+    } else if (std::strcmp(argv[i], "--congestion") == 0) {
+      options.congestion = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--alloc-check") == 0) {
+      options.allocWarmup = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--density-dump") == 0) {
+      options.densityDir = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--density-every") == 0) {
+      options.densityEvery = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--view") == 0) {
+      float x, y, w, h;
+      if (sscanf(argv[i + 1], "%f,%f,%f,%f", &x, &y, &w, &h) == 4) {
+        options.view = {x, y, x + w, y + h};
+        options.viewSet = true;
+      }
+    } else if (std::strcmp(argv[i], "--goal") == 0) {
+      HeadlessOptions::GoalDisc goal;
+      if (sscanf(argv[i + 1], "%f,%f,%f", &goal.x, &goal.y, &goal.radius) ==
+          3)
+        options.goals.push_back(goal);
+    } else if (std::strcmp(argv[i], "--ensemble") == 0) {
+      options.ensembleRuns = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--ensemble-threads") == 0) {
+      options.ensembleThreads = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--seed") == 0) {
+      options.seed = std::strtoul(argv[i + 1], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--los-bench") == 0) {
+      options.losQueries = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--frames") == 0) {
+      options.framesDir = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--encode") == 0) {
+      options.encodeCommand = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--capture-size") == 0) {
+      sscanf(argv[i + 1], "%dx%d", &options.captureWidth,
+             &options.captureHeight);
+    } else if (std::strcmp(argv[i], "--capture-every") == 0) {
+      options.captureEvery = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--metrics") == 0) {
+      options.metricsEndpoint = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--frame-budget") == 0) {
+      options.frameBudget = std::atof(argv[i + 1]);
+    }
+  }
+
+  Metrics metrics;
+  bool serving =
+      options.metricsEndpoint && metrics.serve(options.metricsEndpoint);
+
+  if (options.workers > 0 || options.ensembleRuns > 0 ||
+      options.losQueries > 0)
+    return runHeadless(options, serving ? &metrics : nullptr);
+
+  // The windowed game takes --metrics and --frame-budget MS (default 16.7;
+  // 0 keeps full quality however slow frames get).
   game = new Game();
+  if (serving)
+    game->setMetrics(&metrics);
+  game->setFrameBudget(options.frameBudget);
 
   if (game->init("Zombie Flood", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
                  800, 600, false)) {